@@ -0,0 +1,165 @@
+// Benjamin Smith bxs566 ipv4.c
+// dotted quad parsing and formatting shared by the projects
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ipv4.h"
+
+/* the digits of every octet then a '.', four bytes each so one is a single copy */
+static const char octets[256 * 4 + 1] =
+	"0.\0\0" "1.\0\0" "2.\0\0" "3.\0\0" "4.\0\0" "5.\0\0" "6.\0\0" "7.\0\0"
+	"8.\0\0" "9.\0\0" "10.\0" "11.\0" "12.\0" "13.\0" "14.\0" "15.\0"
+	"16.\0" "17.\0" "18.\0" "19.\0" "20.\0" "21.\0" "22.\0" "23.\0"
+	"24.\0" "25.\0" "26.\0" "27.\0" "28.\0" "29.\0" "30.\0" "31.\0"
+	"32.\0" "33.\0" "34.\0" "35.\0" "36.\0" "37.\0" "38.\0" "39.\0"
+	"40.\0" "41.\0" "42.\0" "43.\0" "44.\0" "45.\0" "46.\0" "47.\0"
+	"48.\0" "49.\0" "50.\0" "51.\0" "52.\0" "53.\0" "54.\0" "55.\0"
+	"56.\0" "57.\0" "58.\0" "59.\0" "60.\0" "61.\0" "62.\0" "63.\0"
+	"64.\0" "65.\0" "66.\0" "67.\0" "68.\0" "69.\0" "70.\0" "71.\0"
+	"72.\0" "73.\0" "74.\0" "75.\0" "76.\0" "77.\0" "78.\0" "79.\0"
+	"80.\0" "81.\0" "82.\0" "83.\0" "84.\0" "85.\0" "86.\0" "87.\0"
+	"88.\0" "89.\0" "90.\0" "91.\0" "92.\0" "93.\0" "94.\0" "95.\0"
+	"96.\0" "97.\0" "98.\0" "99.\0" "100." "101." "102." "103."
+	"104." "105." "106." "107." "108." "109." "110." "111."
+	"112." "113." "114." "115." "116." "117." "118." "119."
+	"120." "121." "122." "123." "124." "125." "126." "127."
+	"128." "129." "130." "131." "132." "133." "134." "135."
+	"136." "137." "138." "139." "140." "141." "142." "143."
+	"144." "145." "146." "147." "148." "149." "150." "151."
+	"152." "153." "154." "155." "156." "157." "158." "159."
+	"160." "161." "162." "163." "164." "165." "166." "167."
+	"168." "169." "170." "171." "172." "173." "174." "175."
+	"176." "177." "178." "179." "180." "181." "182." "183."
+	"184." "185." "186." "187." "188." "189." "190." "191."
+	"192." "193." "194." "195." "196." "197." "198." "199."
+	"200." "201." "202." "203." "204." "205." "206." "207."
+	"208." "209." "210." "211." "212." "213." "214." "215."
+	"216." "217." "218." "219." "220." "221." "222." "223."
+	"224." "225." "226." "227." "228." "229." "230." "231."
+	"232." "233." "234." "235." "236." "237." "238." "239."
+	"240." "241." "242." "243." "244." "245." "246." "247."
+	"248." "249." "250." "251." "252." "253." "254." "255.";
+
+/* the masks of the bytes of p[0..15] that are '.' and digits, and p[0..15]
+   less '0' stored to d, p must have 16 readable bytes */
+static inline void classify(const char *p, unsigned *dots, unsigned *digits, unsigned char *d)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	/* signed compares, bytes over 0x7f are negative so never digits */
+	__m128i isdigit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+
+	*dots = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+	*digits = _mm_movemask_epi8(isdigit);
+	_mm_storeu_si128((__m128i *)d, _mm_sub_epi8(v, _mm_set1_epi8('0')));
+#else
+	*dots = *digits = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		unsigned char c = p[i];
+		*dots |= (unsigned)(c == '.') << i;
+		*digits |= (unsigned)((unsigned)(c - '0') < 10) << i;
+		d[i] = c - '0';
+	}
+#endif
+}
+
+/* the octet of the n digits at d, with bad set if it is not one */
+static inline uint32_t octet(const unsigned char *d, unsigned n, unsigned *bad)
+{
+	uint32_t one = d[0], two = d[0] * 10 + d[1], three = d[0] * 100 + d[1] * 10 + d[2];
+	uint32_t v = (one & -(uint32_t)(n == 1)) | (two & -(uint32_t)(n == 2)) | (three & -(uint32_t)(n == 3));
+
+	/* empty or too long, a leading zero, or too big */
+	*bad |= (n - 1 > 2) | ((n > 1) & (d[0] == 0)) | (v > 255);
+	return v;
+}
+
+/* ipv4parse of the len bytes at s, which has at least 16 readable, so
+   addresses in a larger buffer are read in place */
+int ipv4parse16(const char *s, size_t len, uint32_t *addr)
+{
+	unsigned char d[32] = {0};
+	unsigned dots, digits, inside, a, b, c, bad = 0;
+
+	if (len < IPV4MINLEN || len > IPV4MAXLEN)
+		return 0;
+	classify(s, &dots, &digits, d);
+	inside = (1u << len) - 1;
+	dots &= inside;
+	digits &= inside;
+	if ((dots | digits) != inside)
+		return 0;
+
+	/* three dots, so four fields, the rest is arithmetic
+	   counted by clearing the lowest, popcount is a call without -mpopcnt */
+	a = __builtin_ctz(dots | 0x10000);
+	dots &= dots - 1;
+	b = __builtin_ctz(dots | 0x10000);
+	dots &= dots - 1;
+	c = __builtin_ctz(dots | 0x10000);
+	if (c == 16 || (dots & (dots - 1)) != 0)
+		return 0;
+	*addr = octet(d, a, &bad) << 24 | octet(d + a + 1, b - a - 1, &bad) << 16 | octet(d + b + 1, c - b - 1, &bad) << 8 |
+			octet(d + c + 1, len - c - 1, &bad);
+	return !bad;
+}
+
+/* 1 if the len bytes at s are a dotted quad: four fields of one to three
+   digits, no leading zeros, none over 255, its value goes to addr */
+int ipv4parse(const char *s, size_t len, uint32_t *addr)
+{
+	char copy[16] = {0};
+
+	if (len < IPV4MINLEN || len > IPV4MAXLEN)
+		return 0;
+	memcpy(copy, s, len);
+	return ipv4parse16(copy, len, addr);
+}
+
+/* ipv4parse of each of n strings, whether it was to valid
+   returns how many were */
+size_t ipv4parsen(const char *const *s, const size_t *len, uint32_t *addrs, unsigned char *valid, size_t n)
+{
+	size_t good = 0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		valid[i] = ipv4parse(s[i], len[i], &addrs[i]);
+		good += valid[i];
+	}
+	return good;
+}
+
+/* the dotted quad of addr at buf, which needs IPV4BUFLEN bytes,
+   terminated, returns its length */
+size_t ipv4format(uint32_t addr, char *buf)
+{
+	char *p = buf;
+
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		unsigned v = (addr >> shift) & 0xff;
+		memcpy(p, &octets[v * 4], 4);
+		p += 2 + (v >= 10) + (v >= 100);
+	}
+	/* the last '.' becomes the end */
+	*--p = '\0';
+	return p - buf;
+}
+
+/* the dotted quads of n addresses at buf, each followed by sep, buf
+   needs n * IPV4BUFLEN bytes, returns the length of them all */
+size_t ipv4formatn(const uint32_t *addrs, size_t n, char sep, char *buf)
+{
+	char *p = buf;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		p += ipv4format(addrs[i], p);
+		*p++ = sep;
+	}
+	return p - buf;
+}
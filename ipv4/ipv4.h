@@ -0,0 +1,13 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#define IPV4MAXLEN 15           /* 255.255.255.255 */
+#define IPV4MINLEN 7            /* 0.0.0.0 */
+#define IPV4BUFLEN 16           /* a formatted address and its '\0' */
+
+/* addresses are host order, a.b.c.d is a << 24 | b << 16 | c << 8 | d */
+int ipv4parse(const char *s, size_t len, uint32_t *addr);
+int ipv4parse16(const char *s, size_t len, uint32_t *addr);
+size_t ipv4parsen(const char *const *s, const size_t *len, uint32_t *addrs, unsigned char *valid, size_t n);
+size_t ipv4format(uint32_t addr, char *buf);
+size_t ipv4formatn(const uint32_t *addrs, size_t n, char sep, char *buf);
@@ -0,0 +1,127 @@
+// Benjamin Smith bxs566 ipv4bench.c
+// ipv4parse and ipv4format against inet_pton and inet_ntoa
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "ipv4.h"
+
+#define DEFAULT_COUNT 10000000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, size_t n, double secs)
+{
+	printf("%-16s %8.1f M/s\n", name, n / secs / 1e6);
+}
+
+/* a random line like the validator sees: mostly addresses, some with
+   leading zeros or octets too big, some not addresses at all */
+static size_t randomline(char *buf)
+{
+	static const char junk[] = "0123456789....x ";
+	int kind = rand() % 8;
+
+	if (kind < 5)
+		return sprintf(buf, "%d.%d.%d.%d", rand() % 256, rand() % 256, rand() % 256, rand() % 256);
+	if (kind == 5)
+		return sprintf(buf, "%d.%03d.%d.%d", rand() % 256, rand() % 256, rand() % 300, rand() % 256);
+	size_t len = rand() % 17;
+	for (size_t i = 0; i < len; i++)
+		buf[i] = junk[rand() % (sizeof(junk) - 1)];
+	buf[len] = '\0';
+	return len;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t n = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_COUNT;
+	char *text = malloc(n * IPV4BUFLEN), *out = malloc(n * IPV4BUFLEN);
+	const char **s = malloc(n * sizeof(char *));
+	size_t *len = malloc(n * sizeof(size_t));
+	uint32_t *addrs = malloc(n * sizeof(uint32_t));
+	unsigned char *valid = malloc(n);
+	size_t good = 0, bad = 0;
+	double start;
+
+	if (n == 0 || text == NULL || out == NULL || s == NULL || len == NULL || addrs == NULL || valid == NULL)
+	{
+		fprintf(stderr, "error: cannot allocate memory\n");
+		return 1;
+	}
+	srand(325);
+	for (size_t i = 0; i < n; i++)
+	{
+		s[i] = text + i * IPV4BUFLEN;
+		len[i] = randomline(text + i * IPV4BUFLEN);
+	}
+
+	/* both agree on every line before either is timed */
+	for (size_t i = 0; i < n; i++)
+	{
+		struct in_addr a;
+		uint32_t addr;
+		char buf[IPV4BUFLEN];
+		int ours = ipv4parse(s[i], len[i], &addr), theirs = inet_pton(AF_INET, s[i], &a);
+
+		if (ours != theirs || (ours && addr != ntohl(a.s_addr)))
+			bad++;
+		else if (ours && (ipv4format(addr, buf) != strlen(inet_ntoa(a)) || strcmp(buf, inet_ntoa(a)) != 0))
+			bad++;
+	}
+	if (bad != 0)
+	{
+		fprintf(stderr, "error: %zu of %zu lines differ from inet_pton and inet_ntoa\n", bad, n);
+		return 1;
+	}
+	printf("%zu lines agree with inet_pton and inet_ntoa\n", n);
+
+	start = now();
+	for (size_t i = 0; i < n; i++)
+	{
+		struct in_addr a;
+		good += inet_pton(AF_INET, s[i], &a);
+		addrs[i] = a.s_addr;
+	}
+	report("inet_pton", n, now() - start);
+	start = now();
+	for (size_t i = 0; i < n; i++)
+		good += ipv4parse(s[i], len[i], &addrs[i]);
+	report("ipv4parse", n, now() - start);
+	start = now();
+	for (size_t i = 0; i < n; i++)
+		good += ipv4parse16(s[i], len[i], &addrs[i]);
+	report("ipv4parse16", n, now() - start);
+	start = now();
+	good += ipv4parsen(s, len, addrs, valid, n);
+	report("ipv4parsen", n, now() - start);
+
+	for (size_t i = 0; i < n; i++)
+		addrs[i] = (uint32_t)rand() << 16 ^ rand();
+	start = now();
+	for (size_t i = 0; i < n; i++)
+	{
+		struct in_addr a = {htonl(addrs[i])};
+		strcpy(out + i * IPV4BUFLEN, inet_ntoa(a));
+	}
+	report("inet_ntoa", n, now() - start);
+	start = now();
+	for (size_t i = 0; i < n; i++)
+		ipv4format(addrs[i], out + i * IPV4BUFLEN);
+	report("ipv4format", n, now() - start);
+	start = now();
+	good += ipv4formatn(addrs, n, '\n', out);
+	report("ipv4formatn", n, now() - start);
+
+	/* so none of it is optimized away */
+	fprintf(stderr, "%zu\n", good + out[n]);
+	return 0;
+}
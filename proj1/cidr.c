@@ -0,0 +1,201 @@
+// Benjamin Smith bxs566 cidr.c
+// prefix lists in a DIR-24-8 table for longest match lookups
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "validate.h"
+#include "cidr.h"
+
+static inline uint32_t mask(int len)
+{
+	return len ? ~0u << (32 - len) : 0;
+}
+
+/* a.b.c.d/len, or a.b.c.d alone for a /32, host bits are dropped
+   returns 0, or -1 if s is not one */
+int parsecidr(const char *s, size_t len, uint32_t *addr, int *plen)
+{
+	const char *slash = memchr(s, '/', len);
+	size_t alen = slash ? (size_t)(slash - s) : len;
+	int bits = 0;
+
+	if (!ipv4parse(s, alen, addr))
+		return -1;
+	if (slash == NULL)
+	{
+		*plen = 32;
+		return 0;
+	}
+	/* one or two digits, no more than 32 */
+	len -= alen + 1;
+	if (len < 1 || len > 2)
+		return -1;
+	for (size_t i = 0; i < len; i++)
+	{
+		if (slash[1 + i] < '0' || slash[1 + i] > '9')
+			return -1;
+		bits = bits * 10 + slash[1 + i] - '0';
+	}
+	if (bits > 32)
+		return -1;
+	*plen = bits;
+	*addr &= mask(bits);
+	return 0;
+}
+
+/* addr/len at buf, which needs CIDRMAXLEN bytes, returns its length */
+size_t formatcidr(uint32_t addr, int len, char *buf)
+{
+	size_t n = ipv4format(addr, buf);
+
+	buf[n++] = '/';
+	if (len >= 10)
+		buf[n++] = '0' + len / 10;
+	buf[n++] = '0' + len % 10;
+	return n;
+}
+
+/* add the prefixes of file, one a line with anything after the prefix
+   kept as part of its tag, blank lines and # comments are skipped
+   returns 0, or -1 having said what was wrong */
+int prefixload(struct prefixtable *t, const char *file)
+{
+	FILE *f = fopen(file, "r");
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int lineno = 0, error = 0;
+
+	if (f == NULL)
+	{
+		fprintf(stderr, "error: cannot open prefix list %s\n", file);
+		return -1;
+	}
+	while (!error && (len = getline(&line, &size, f)) >= 0)
+	{
+		struct prefix *p;
+		lineno++;
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+		if (t->n == t->cap)
+		{
+			struct prefix *more = realloc(t->prefixes, (t->cap = t->cap ? t->cap * 2 : 1024) * sizeof(struct prefix));
+			if (more == NULL)
+			{
+				fprintf(stderr, "error: cannot allocate memory\n");
+				error = -1;
+				break;
+			}
+			t->prefixes = more;
+		}
+		p = &t->prefixes[t->n];
+		if (parsecidr(line, strcspn(line, " \t"), &p->addr, &p->len) < 0)
+		{
+			fprintf(stderr, "error: %s:%d: not a prefix: %s\n", file, lineno, line);
+			error = -1;
+		}
+		else if ((p->tag = strdup(line)) == NULL)
+		{
+			fprintf(stderr, "error: cannot allocate memory\n");
+			error = -1;
+		}
+		else
+		{
+			p->taglen = len;
+			if ((size_t)len > t->maxtag)
+				t->maxtag = len;
+			t->n++;
+		}
+	}
+	free(line);
+	fclose(f);
+	return error;
+}
+
+static int shorter(const void *a, const void *b)
+{
+	const struct prefix *x = *(const struct prefix **)a, *y = *(const struct prefix **)b;
+
+	if (x->len != y->len)
+		return x->len - y->len;
+	/* the same length keeps list order, so the last of a prefix listed twice wins */
+	return (x < y) ? -1 : (x > y);
+}
+
+/* fill the tables, shortest prefixes first so longer ones inside them
+   overwrite their entries, returns 0 or -1 out of memory */
+int prefixbuild(struct prefixtable *t)
+{
+	struct prefix **order = malloc((t->n + 1) * sizeof(struct prefix *));
+	size_t groupcap = 0;
+
+	t->tbl24 = calloc(TBL24SIZE, sizeof(uint32_t));
+	if (order == NULL || t->tbl24 == NULL)
+	{
+		free(order);
+		return -1;
+	}
+	for (size_t i = 0; i < t->n; i++)
+		order[i] = &t->prefixes[i];
+	qsort(order, t->n, sizeof(struct prefix *), shorter);
+
+	for (size_t i = 0; i < t->n; i++)
+	{
+		struct prefix *p = order[i];
+		uint32_t entry = (p - t->prefixes) + 1;
+		uint32_t first = p->addr >> 8;
+
+		if (p->len <= 24)
+		{
+			/* every /24 it covers, and any group already split from one */
+			for (uint32_t e = first; e < first + (1u << (24 - p->len)); e++)
+			{
+				if (t->tbl24[e] & TBLGROUP)
+				{
+					uint32_t *g = &t->tbl8[(size_t)(t->tbl24[e] & ~TBLGROUP) * TBL8SIZE];
+					for (int k = 0; k < TBL8SIZE; k++)
+						g[k] = entry;
+				}
+				else
+					t->tbl24[e] = entry;
+			}
+			continue;
+		}
+
+		/* split its /24 into a group that starts out as the /24 was */
+		if (!(t->tbl24[first] & TBLGROUP))
+		{
+			if (t->groups == groupcap)
+			{
+				uint32_t *more = realloc(t->tbl8, (groupcap = groupcap ? groupcap * 2 : 64) * TBL8SIZE * sizeof(uint32_t));
+				if (more == NULL)
+				{
+					free(order);
+					return -1;
+				}
+				t->tbl8 = more;
+			}
+			for (int k = 0; k < TBL8SIZE; k++)
+				t->tbl8[t->groups * TBL8SIZE + k] = t->tbl24[first];
+			t->tbl24[first] = TBLGROUP | t->groups++;
+		}
+		uint32_t *g = &t->tbl8[(size_t)(t->tbl24[first] & ~TBLGROUP) * TBL8SIZE];
+		for (uint32_t k = p->addr & 0xff; k < (p->addr & 0xff) + (1u << (32 - p->len)); k++)
+			g[k] = entry;
+	}
+	free(order);
+	return 0;
+}
+
+/* the longest prefix that addr is in, or NULL */
+const struct prefix *prefixmatch(const struct prefixtable *t, uint32_t addr)
+{
+	uint32_t e = t->tbl24[addr >> 8];
+
+	if (e & TBLGROUP)
+		e = t->tbl8[(size_t)(e & ~TBLGROUP) * TBL8SIZE + (addr & 0xff)];
+	return e ? &t->prefixes[e - 1] : NULL;
+}
@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#define TBL24SIZE (1 << 24)
+#define TBL8SIZE 256
+#define TBLGROUP 0x80000000u    /* a tbl24 entry that points to a tbl8 group */
+#define CIDRMAXLEN 18           /* 255.255.255.255/32 */
+
+struct prefix
+{
+    uint32_t addr;
+    int len;
+    char *tag;                  /* its line in the prefix list, printed with matches */
+    size_t taglen;
+};
+
+/* DIR-24-8: one tbl24 entry for each /24, holding the longest prefix of
+   24 bits or less that covers it, or pointing to 256 tbl8 entries for a
+   /24 that longer prefixes split, so a lookup is one or two loads
+   entries are 0 for no prefix, or its index + 1 */
+struct prefixtable
+{
+    uint32_t *tbl24;
+    uint32_t *tbl8;
+    size_t groups;
+    struct prefix *prefixes;
+    size_t n;
+    size_t cap;
+    size_t maxtag;
+};
+
+int parsecidr(const char *s, size_t len, uint32_t *addr, int *plen);
+size_t formatcidr(uint32_t addr, int len, char *buf);
+int prefixload(struct prefixtable *t, const char *file);
+int prefixbuild(struct prefixtable *t);
+const struct prefix *prefixmatch(const struct prefixtable *t, uint32_t addr);
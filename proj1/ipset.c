@@ -0,0 +1,179 @@
+// Benjamin Smith bxs566 ipset.c
+// set of distinct ipv4 addresses, hashed while sparse and a bitmap once dense
+
+#include <stdlib.h>
+#include <string.h>
+#include "ipset.h"
+
+#define EMITBATCH 4096
+
+static inline size_t slot(uint32_t addr, size_t cap)
+{
+	/* Fibonacci hashing, the top bits of the product */
+	return (size_t)(((uint64_t)addr * 0x9e3779b97f4a7c15ULL) >> 32) & (cap - 1);
+}
+
+int ipsetinit(struct ipset *s)
+{
+	memset(s, 0, sizeof(struct ipset));
+	s->cap = IPSETMIN;
+	s->table = calloc(s->cap, sizeof(uint32_t));
+	return (s->table == NULL) ? -1 : 0;
+}
+
+static void tableput(uint32_t *table, size_t cap, uint32_t addr)
+{
+	size_t i = slot(addr, cap);
+
+	while (table[i] != 0)
+		i = (i + 1) & (cap - 1);
+	table[i] = addr;
+}
+
+/* the table is half full, double it or give it up for the bitmap */
+static int grow(struct ipset *s)
+{
+	size_t cap = s->cap * 2;
+	uint32_t *table;
+
+	if (cap >= IPSETMAXCAP)
+	{
+		/* calloc maps it, so only the pages addresses fall in are touched */
+		if ((s->bitmap = calloc(IPBITMAPWORDS, sizeof(uint64_t))) == NULL)
+			return -1;
+		for (size_t i = 0; i < s->cap; i++)
+		{
+			if (s->table[i] != 0)
+				s->bitmap[s->table[i] >> 6] |= 1ULL << (s->table[i] & 63);
+		}
+		if (s->haszero)
+			s->bitmap[0] |= 1;
+		free(s->table);
+		s->table = NULL;
+		return 0;
+	}
+	if ((table = calloc(cap, sizeof(uint32_t))) == NULL)
+		return -1;
+	for (size_t i = 0; i < s->cap; i++)
+	{
+		if (s->table[i] != 0)
+			tableput(table, cap, s->table[i]);
+	}
+	free(s->table);
+	s->table = table;
+	s->cap = cap;
+	return 0;
+}
+
+/* add addr, returns 1 if it was new, 0 if not or -1 out of memory */
+int ipsetadd(struct ipset *s, uint32_t addr)
+{
+	size_t i;
+
+	if (s->bitmap != NULL)
+	{
+		uint64_t bit = 1ULL << (addr & 63), *word = &s->bitmap[addr >> 6];
+		int fresh = !(*word & bit);
+		*word |= bit;
+		s->count += fresh;
+		return fresh;
+	}
+	if (addr == 0)
+	{
+		int fresh = !s->haszero;
+		s->haszero = 1;
+		s->count += fresh;
+		return fresh;
+	}
+	for (i = slot(addr, s->cap); s->table[i] != 0; i = (i + 1) & (s->cap - 1))
+	{
+		if (s->table[i] == addr)
+			return 0;
+	}
+	s->table[i] = addr;
+	if (++s->count * 2 > s->cap && grow(s) < 0)
+		return -1;
+	return 1;
+}
+
+/* LSD radix sort of n addresses, 16 bits a pass, using tmp */
+static void radixsort(uint32_t *a, uint32_t *tmp, size_t n)
+{
+	static size_t counts[1 << 16];
+
+	for (int shift = 0; shift < 32; shift += 16)
+	{
+		size_t total = 0;
+		memset(counts, 0, sizeof(counts));
+		for (size_t i = 0; i < n; i++)
+			counts[(a[i] >> shift) & 0xffff]++;
+		for (size_t b = 0; b < (1 << 16); b++)
+		{
+			size_t c = counts[b];
+			counts[b] = total;
+			total += c;
+		}
+		for (size_t i = 0; i < n; i++)
+			tmp[counts[(a[i] >> shift) & 0xffff]++] = a[i];
+		uint32_t *swap = a;
+		a = tmp;
+		tmp = swap;
+	}
+}
+
+/* hand every address to emit in ascending order, in batches, returns 0,
+   -1 out of memory, or what a failed emit returned */
+int ipsetsorted(struct ipset *s, int (*emit)(const uint32_t *addrs, size_t n, void *arg), void *arg)
+{
+	uint32_t batch[EMITBATCH], *all, *tmp;
+	size_t n = 0, k = 0;
+	int error = 0;
+
+	if (s->bitmap != NULL)
+	{
+		/* already in order, just find the bits */
+		for (uint64_t w = 0; w < IPBITMAPWORDS && !error; w++)
+		{
+			for (uint64_t bits = s->bitmap[w]; bits != 0; bits &= bits - 1)
+			{
+				batch[k++] = (w << 6) | __builtin_ctzll(bits);
+				if (k == EMITBATCH)
+				{
+					error = emit(batch, k, arg);
+					k = 0;
+				}
+			}
+		}
+		if (k > 0 && !error)
+			error = emit(batch, k, arg);
+		return error;
+	}
+
+	if ((all = malloc((s->count + 1) * sizeof(uint32_t))) == NULL || (tmp = malloc((s->count + 1) * sizeof(uint32_t))) == NULL)
+	{
+		free(all);
+		return -1;
+	}
+	if (s->haszero)
+		all[n++] = 0;
+	for (size_t i = 0; i < s->cap; i++)
+	{
+		if (s->table[i] != 0)
+			all[n++] = s->table[i];
+	}
+	/* two passes, so the sorted addresses end up back in all */
+	radixsort(all, tmp, n);
+	for (size_t i = 0; i < n && !error; i += EMITBATCH)
+		error = emit(all + i, (n - i < EMITBATCH) ? n - i : EMITBATCH, arg);
+	free(all);
+	free(tmp);
+	return error;
+}
+
+void ipsetfree(struct ipset *s)
+{
+	free(s->table);
+	free(s->bitmap);
+	s->table = NULL;
+	s->bitmap = NULL;
+}
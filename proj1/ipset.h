@@ -0,0 +1,26 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#define IPSETMIN 1024                   /* first hash table, in slots */
+#define IPBITMAPWORDS ((1ULL << 32) / 64)  /* 512 MiB, a bit for every address */
+#ifndef IPSETMAXCAP
+#define IPSETMAXCAP (1 << 23)   /* 32 MiB, past the caches a bitmap is cheaper */
+#endif
+
+/* the distinct addresses seen, in a hash table while there are few and
+   in a bitmap of the whole space once there are millions, when every
+   insert into the table misses the cache anyway and growing it means
+   rehashing them all */
+struct ipset
+{
+    uint32_t *table;            /* open addressing, 0 marks a free slot */
+    size_t cap;                 /* slots, a power of two */
+    int haszero;                /* 0.0.0.0, which cannot go in the table */
+    uint64_t *bitmap;           /* NULL until dense */
+    size_t count;
+};
+
+int ipsetinit(struct ipset *s);
+int ipsetadd(struct ipset *s, uint32_t addr);
+int ipsetsorted(struct ipset *s, int (*emit)(const uint32_t *addrs, size_t n, void *arg), void *arg);
+void ipsetfree(struct ipset *s);
@@ -4,58 +4,38 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <ctype.h>
+#include <fcntl.h>
+#include "validate.h"
+#include "scan.h"
+#include "ipset.h"
+#include "cidr.h"
 
 #define ARG_SUMMARY 0x1
 #define ARG_LIST 0x2
-#define STR_END '\0'
-#define BUFFER_SIZE 1024
-#define NUM_QUADS 4
+#define ARG_UNIQUE 0x4
+#define ARG_DEDUP 0x8
+#define ARG_AGGREGATE 0x10
+#define OUT_SIZE (1 << 20)
 
 char *filename = NULL;
-FILE *file;
+int fd;
 unsigned short cmd_line_flags = 0;
-int input_lines;
-int valid_ips;
-int invalid_ips;
-
-int validateip(char **ip)
-{
-	char *quad;
-	int quad_count = 0;
-	unsigned short is_valid = 1;
-	while ((quad = strsep(ip, ".")) != NULL && is_valid)
-	{
-		quad_count++;
-		int quad_len = strlen(quad);
-		if (quad_len > 3)
-			is_valid = 0;
-		else if (quad_len == 0)
-			is_valid = 0;
-		else if (quad_len > 1 && quad[0] == '0')
-			is_valid = 0;
-		else if (atoi(quad) > 255)
-			is_valid = 0;
-		else
-		{
-			for (char *c = &quad[0]; *c != STR_END; c++)
-			{
-				if (!(isdigit(*c)))
-					is_valid = 0;
-			}
-		}
-	}
-	if (quad_count != NUM_QUADS)
-		is_valid = 0;
-	return (is_valid);
-}
+int threads = 0;
+struct ipset seen;
+struct prefixtable prefixes;
+int tagging = 0;
 
 void usage(char *progname)
 {
-	fprintf(stderr, "%s [-s] [-l] -f filename\n", progname);
+	fprintf(stderr, "%s [-s] [-l] [-u] [-d] [-a] [-p prefixes]... [-t threads] [-f filename]\n", progname);
 	fprintf(stderr, "    -s    run in summary mode\n");
 	fprintf(stderr, "    -l    run in list mode\n");
-	fprintf(stderr, "    -f X  specify input file \'X\'\n");
+	fprintf(stderr, "    -u    run in summary mode, counting distinct valid addresses too\n");
+	fprintf(stderr, "    -d    list the distinct valid addresses in order\n");
+	fprintf(stderr, "    -a    list the fewest prefixes that cover just the valid addresses\n");
+	fprintf(stderr, "    -p X  tag list mode addresses with their longest prefix in list \'X\'\n");
+	fprintf(stderr, "    -f X  specify input file \'X\' (default standard input)\n");
+	fprintf(stderr, "    -t N  validate on N threads (default one per CPU)\n");
 	exit(1);
 }
 
@@ -63,7 +43,7 @@ void parseargs(int argc, char *argv[])
 {
 	int opt;
 
-	while ((opt = getopt(argc, argv, "slf:")) != -1)
+	while ((opt = getopt(argc, argv, "sludap:f:t:")) != -1)
 	{
 		switch (opt)
 		{
@@ -73,9 +53,26 @@ void parseargs(int argc, char *argv[])
 		case 'l':
 			cmd_line_flags |= ARG_LIST;
 			break;
+		case 'u':
+			cmd_line_flags |= ARG_UNIQUE;
+			break;
+		case 'd':
+			cmd_line_flags |= ARG_DEDUP;
+			break;
+		case 'a':
+			cmd_line_flags |= ARG_AGGREGATE;
+			break;
+		case 'p':
+			if (prefixload(&prefixes, optarg) < 0)
+				exit(1);
+			tagging = 1;
+			break;
 		case 'f':
 			filename = optarg;
 			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
 		case '?':
 		default:
 			usage(argv[0]);
@@ -83,108 +80,266 @@ void parseargs(int argc, char *argv[])
 	}
 	if (cmd_line_flags == 0)
 	{
-		fprintf(stderr, "error: specify either -s or -l\n");
+		fprintf(stderr, "error: specify one of -s, -l, -u, -d or -a\n");
+		usage(argv[0]);
+	}
+	if (tagging && cmd_line_flags != ARG_LIST)
+	{
+		fprintf(stderr, "error: -p tags list mode output, use it with -l\n");
 		usage(argv[0]);
 	}
 }
 
-int summinput(FILE *file)
+int countlines(struct ipline *lines, size_t n, struct scan *s)
 {
-	char *buffer = malloc(BUFFER_SIZE);
-	if (buffer == NULL)
+	for (size_t i = 0; i < n; i++)
 	{
-		fprintf(stderr, "error: cannot allocate memory\n");
-		return 1;
+		s->valid += lines[i].valid;
+		s->lines += !lines[i].more;
 	}
-	while (fgets(buffer, BUFFER_SIZE, file) != NULL)
+	return 0;
+}
+
+int printlines(struct ipline *lines, size_t n, struct scan *s)
+{
+	char *out;
+
+	if (n == 0)
+		return 0;
+	/* every line grows by " +" and a tag at most, and gains a newline if it had none */
+	if ((out = outreserve(s, lines[n - 1].text + lines[n - 1].len - lines[0].text + (3 + (tagging ? 1 + prefixes.maxtag : 0)) * n)) == NULL)
+		return -1;
+	for (size_t i = 0; i < n; i++)
 	{
-		input_lines++;
-		char *line = strdup(buffer);
-		char *line_ptr = line;
-		if (line == NULL)
+		memcpy(out, lines[i].text, lines[i].len);
+		out += lines[i].len;
+		if (lines[i].more)
+			continue;
+		*out++ = ' ';
+		*out++ = lines[i].valid ? '+' : '-';
+		if (tagging && lines[i].valid)
 		{
-			fprintf(stderr, "error: cannot allocate memory\n");
-			return 1;
+			const struct prefix *p = prefixmatch(&prefixes, lines[i].addr);
+			if (p != NULL)
+			{
+				*out++ = ' ';
+				memcpy(out, p->tag, p->taglen);
+				out += p->taglen;
+			}
 		}
-		line[strcspn(line, "\n")] = 0;	// remove newline
-		if (validateip(&line))
-			valid_ips++;
-		else
-			invalid_ips++;
-		free(line_ptr);
-	}
-	printf("LINES: %d\n", input_lines);
-	printf("VALID: %d\n", valid_ips);
-	printf("INVALID: %d\n", invalid_ips);
-	free(buffer);
+		*out++ = '\n';
+		s->lines++;
+	}
+	s->outlen = out - s->out;
 	return 0;
 }
 
-int listinput(FILE *file)
+/* the valid addresses of a batch, to go into the set in input order */
+int collectaddrs(struct ipline *lines, size_t n, struct scan *s)
 {
-	char *buffer = malloc(BUFFER_SIZE);
-	if (buffer == NULL)
+	uint32_t *out;
+
+	if ((out = (uint32_t *)outreserve(s, n * sizeof(uint32_t))) == NULL)
+		return -1;
+	for (size_t i = 0; i < n; i++)
 	{
-		fprintf(stderr, "error: cannot allocate memory\n");
-		return 1;
+		*out = lines[i].addr;
+		out += lines[i].valid;
+		s->valid += lines[i].valid;
+		s->lines += !lines[i].more;
+	}
+	s->outlen = (char *)out - s->out;
+	return 0;
+}
+
+int addaddrs(const char *out, size_t len)
+{
+	const uint32_t *addrs = (const uint32_t *)out;
+
+	for (size_t i = 0; i < len / sizeof(uint32_t); i++)
+	{
+		if (ipsetadd(&seen, addrs[i]) < 0)
+			return -1;
 	}
-	while (fgets(buffer, BUFFER_SIZE, file) != NULL)
+	return 0;
+}
+
+static char outbuf[OUT_SIZE];
+static size_t outused = 0;
+
+int outflush(void)
+{
+	if (outused > 0 && writeall(STDOUT_FILENO, outbuf, outused) < 0)
+		return -1;
+	outused = 0;
+	return 0;
+}
+
+/* room for len more bytes of output at outbuf + outused */
+int outroom(size_t len)
+{
+	return (outused + len > OUT_SIZE) ? outflush() : 0;
+}
+
+int printaddrs(const uint32_t *addrs, size_t n, void *arg)
+{
+	/* n 0 is the end, flush what is left */
+	for (size_t i = 0; i < n;)
 	{
-		input_lines++;
-		char *line = strdup(buffer);
-		if (line == NULL)
+		size_t k = (n - i < OUT_SIZE / IPV4BUFLEN) ? n - i : OUT_SIZE / IPV4BUFLEN;
+		if (outroom(k * IPV4BUFLEN) < 0)
+			return -1;
+		outused += ipv4formatn(addrs + i, k, '\n', outbuf + outused);
+		i += k;
+	}
+	return (n == 0) ? outflush() : 0;
+}
+
+/* lo to hi as the fewest prefixes, each the largest aligned block that fits */
+int printrange(uint32_t lo, uint32_t hi)
+{
+	uint64_t a = lo, end = (uint64_t)hi + 1;
+
+	while (a < end)
+	{
+		int bits = a ? __builtin_ctz((uint32_t)a) : 32;
+		while (a + (1ULL << bits) > end)
+			bits--;
+		if (outroom(CIDRMAXLEN + 1) < 0)
+			return -1;
+		outused += formatcidr(a, 32 - bits, outbuf + outused);
+		outbuf[outused++] = '\n';
+		a += 1ULL << bits;
+	}
+	return 0;
+}
+
+int printcidrs(const uint32_t *addrs, size_t n, void *arg)
+{
+	static uint32_t lo, hi;
+	static int open = 0;
+
+	/* runs of consecutive addresses carry across calls until a gap, or n 0 the end */
+	for (size_t i = 0; i < n; i++)
+	{
+		if (open && addrs[i] == hi + 1)
 		{
-			fprintf(stderr, "error: cannot allocate memory\n");
-			return 1;
+			hi++;
+			continue;
 		}
-		line[strcspn(line, "\n")] = 0;	// remove newline
-		char *line_copy = strdup(line); // preserve original line
-		char *line_copy_ptr = line_copy;
-		char is_valid;
-		if (validateip(&line_copy))
-			is_valid = '+';
-		else
-			is_valid = '-';
-		printf("%s %c\n", line, is_valid);
-		free(line);
-		free(line_copy_ptr);
-	}
-	free(buffer);
+		if (open && printrange(lo, hi) < 0)
+			return -1;
+		lo = hi = addrs[i];
+		open = 1;
+	}
+	if (n == 0)
+	{
+		if (open && printrange(lo, hi) < 0)
+			return -1;
+		open = 0;
+		return outflush();
+	}
+	return 0;
+}
+
+int summinput(int fd)
+{
+	struct scan total = {0};
+
+	if (scanfile(fd, threads, countlines, NULL, &total) != 0)
+		return 1;
+	printf("LINES: %lld\n", total.lines);
+	printf("VALID: %lld\n", total.valid);
+	printf("INVALID: %lld\n", total.lines - total.valid);
+	return 0;
+}
+
+int listinput(int fd)
+{
+	struct scan total = {0};
+
+	return scanfile(fd, threads, printlines, NULL, &total);
+}
+
+int uniqueinput(int fd)
+{
+	struct scan total = {0};
+
+	if (ipsetinit(&seen) < 0 || scanfile(fd, threads, collectaddrs, addaddrs, &total) != 0)
+		return 1;
+	printf("LINES: %lld\n", total.lines);
+	printf("VALID: %lld\n", total.valid);
+	printf("INVALID: %lld\n", total.lines - total.valid);
+	printf("UNIQUE: %zu\n", seen.count);
+	ipsetfree(&seen);
 	return 0;
 }
 
+int dedupinput(int fd, int (*emit)(const uint32_t *, size_t, void *))
+{
+	struct scan total = {0};
+	int error;
+
+	if (ipsetinit(&seen) < 0 || scanfile(fd, threads, collectaddrs, addaddrs, &total) != 0)
+		return 1;
+	error = ipsetsorted(&seen, emit, NULL);
+	if (error == 0)
+		error = emit(NULL, 0, NULL);
+	if (error != 0)
+		fprintf(stderr, "error: cannot write output\n");
+	ipsetfree(&seen);
+	return error != 0;
+}
+
 int main(int argc, char *argv[])
 {
 	parseargs(argc, argv);
 	int error = 0;
 
 	if (filename == NULL)
-	{
-		fprintf(stderr, "error: filename required\n");
-	}
-
-	file = fopen(filename, "r");
-	if (file == NULL)
+		fd = STDIN_FILENO;
+	else if ((fd = open(filename, O_RDONLY)) < 0)
 	{
 		fprintf(stderr, "error: cannot open file %s\n", filename);
-		error = 1;
+		exit(1);
 	}
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
 
 	if (cmd_line_flags == ARG_SUMMARY)
 	{
 		// run in summary mode
-		error = summinput(file);
+		error = summinput(fd);
 	}
 	else if (cmd_line_flags == ARG_LIST)
 	{
 		// run in list mode
-		error = listinput(file);
+		if (tagging && prefixbuild(&prefixes) < 0)
+		{
+			fprintf(stderr, "error: cannot allocate memory\n");
+			exit(1);
+		}
+		error = listinput(fd);
+	}
+	else if (cmd_line_flags == ARG_UNIQUE)
+	{
+		error = uniqueinput(fd);
+	}
+	else if (cmd_line_flags == ARG_DEDUP)
+	{
+		error = dedupinput(fd, printaddrs);
+	}
+	else if (cmd_line_flags == ARG_AGGREGATE)
+	{
+		error = dedupinput(fd, printcidrs);
 	}
 	else
 	{
-		fprintf(stderr, "error: specify exactly one of -s and -l \n");
+		fprintf(stderr, "error: specify exactly one of -s, -l, -u, -d and -a\n");
 		error = 1;
 	}
-	fclose(file);
+	close(fd);
 	exit(error);
-}
\ No newline at end of file
+}
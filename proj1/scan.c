@@ -0,0 +1,308 @@
+// Benjamin Smith bxs566 scan.c
+// run the validator over a whole input, mapped and on many threads when possible
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "validate.h"
+#include "scan.h"
+
+/* room for len more bytes of output, NULL if there is none */
+char *outreserve(struct scan *s, size_t len)
+{
+	if (s->outlen + len > s->outcap)
+	{
+		size_t cap = s->outcap ? s->outcap : 65536;
+		char *more;
+		while (cap < s->outlen + len)
+			cap *= 2;
+		if ((more = realloc(s->out, cap)) == NULL)
+		{
+			s->error = ENOMEM;
+			return NULL;
+		}
+		s->out = more;
+		s->outcap = cap;
+	}
+	return s->out + s->outlen;
+}
+
+int writeall(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		if ((n = write(fd, buf, len)) < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* hand what s has to the sink, or stdout without one, and add its
+   counts to total */
+static int drain(struct scan *s, sinkfn sink, struct scan *total)
+{
+	total->lines += s->lines;
+	total->valid += s->valid;
+	s->lines = s->valid = 0;
+	if (s->error)
+	{
+		fprintf(stderr, "error: %s\n", strerror(s->error));
+		return 1;
+	}
+	if (s->outlen > 0 && sink != NULL && sink(s->out, s->outlen) < 0)
+	{
+		fprintf(stderr, "error: cannot allocate memory\n");
+		return 1;
+	}
+	if (s->outlen > 0 && sink == NULL && writeall(STDOUT_FILENO, s->out, s->outlen) < 0)
+	{
+		fprintf(stderr, "error: cannot write output: %s\n", strerror(errno));
+		return 1;
+	}
+	s->outlen = 0;
+	return 0;
+}
+
+/* all the lines of len bytes at buf, which end at a line end */
+static int scanlines(const char *buf, size_t len, struct ipline *lines, scanfn each, struct scan *s)
+{
+	size_t off = 0, used, n;
+
+	do
+	{
+		used = validatelines(buf + off, len - off, 1, lines, LINE_BATCH, &n);
+		if (each(lines, n, s) < 0)
+			return -1;
+		off += used;
+	} while (n == LINE_BATCH);
+	return 0;
+}
+
+/* read fd a buffer at a time and hand its lines to each in batches,
+   with no copy of any line, a line longer than the buffer goes in
+   pieces, all but the last marked more */
+int scanstream(int fd, scanfn each, sinkfn sink, struct scan *total)
+{
+	static struct ipline lines[LINE_BATCH];
+	char *buffer = malloc(READ_SIZE);
+	struct scan s = {0};
+	size_t have = 0, off, used, n;
+	ssize_t got;
+	int eof = 0, error = 0, inlong = 0;
+
+	if (buffer == NULL)
+	{
+		fprintf(stderr, "error: cannot allocate memory\n");
+		return 1;
+	}
+	while (!error && (!eof || have > 0))
+	{
+		if (!eof && have < READ_SIZE)
+		{
+			if ((got = read(fd, buffer + have, READ_SIZE - have)) < 0 && errno == EINTR)
+				continue;
+			if (got < 0)
+			{
+				fprintf(stderr, "error: cannot read input: %s\n", strerror(errno));
+				error = 1;
+				break;
+			}
+			have += got;
+			eof = (got == 0);
+		}
+		off = 0;
+		do
+		{
+			used = validatelines(buffer + off, have - off, eof, lines, LINE_BATCH, &n);
+			/* the end of a long line, whatever it looks like on its own */
+			if (inlong && n > 0)
+			{
+				lines[0].valid = 0;
+				inlong = 0;
+			}
+			each(lines, n, &s);
+			off += used;
+		} while (n == LINE_BATCH);
+		if (off == 0 && have == READ_SIZE)
+		{
+			/* no newline in the whole buffer, so on to the next piece */
+			lines[0].text = buffer;
+			lines[0].len = have;
+			lines[0].valid = 0;
+			lines[0].more = 1;
+			each(lines, 1, &s);
+			off = have;
+			inlong = 1;
+		}
+		/* keep the part line for the next read */
+		memmove(buffer, buffer + off, have - off);
+		have -= off;
+		error = drain(&s, sink, total);
+	}
+	if (inlong && !error)
+	{
+		/* the input ended inside a long line */
+		lines[0].text = buffer;
+		lines[0].len = 0;
+		lines[0].valid = 0;
+		lines[0].more = 0;
+		each(lines, 1, &s);
+		error = drain(&s, sink, total);
+	}
+	free(buffer);
+	free(s.out);
+	return error;
+}
+
+/* threads share the chunk counter, and the writer, the main thread, takes
+   each chunk's slot in input order once it is done, a thread only starts
+   a chunk whose slot the writer has finished with */
+static struct
+{
+	const char *buf;
+	size_t len;
+	size_t chunks;
+	size_t next;                /* chunk for the next thread to take */
+	size_t written;             /* chunks the writer is done with */
+	size_t window;              /* slots, chunks done but not yet written */
+	struct scan *slots;
+	size_t *done;               /* 1 + the chunk last done in each slot */
+	scanfn each;
+	sinkfn sink;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;       /* a chunk is done */
+	pthread_cond_t room;        /* a slot is free */
+} work = {.lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .room = PTHREAD_COND_INITIALIZER};
+
+/* chunk i is the lines that start in its CHUNK_SIZE bytes, so one that
+   is all the middle of a long line is empty */
+static const char *chunkstart(size_t i)
+{
+	const char *nl;
+
+	if (i == 0)
+		return work.buf;
+	if (i * CHUNK_SIZE >= work.len)
+		return work.buf + work.len;
+	nl = memchr(work.buf + i * CHUNK_SIZE - 1, '\n', work.len - i * CHUNK_SIZE + 1);
+	return (nl == NULL) ? work.buf + work.len : nl + 1;
+}
+
+static void *worker(void *arg)
+{
+	struct ipline *lines = malloc(LINE_BATCH * sizeof(struct ipline));
+	const char *start, *end;
+	struct scan *s;
+	size_t i;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&work.lock);
+		i = work.next++;
+		while (i < work.chunks && i >= work.written + work.window)
+			pthread_cond_wait(&work.room, &work.lock);
+		pthread_mutex_unlock(&work.lock);
+		if (i >= work.chunks)
+			break;
+
+		s = &work.slots[i % work.window];
+		start = chunkstart(i);
+		end = chunkstart(i + 1);
+		if (lines == NULL)
+			s->error = ENOMEM;
+		else if (end > start)
+			scanlines(start, end - start, lines, work.each, s);
+
+		pthread_mutex_lock(&work.lock);
+		work.done[i % work.window] = i + 1;
+		pthread_cond_broadcast(&work.ready);
+		pthread_mutex_unlock(&work.lock);
+	}
+	free(lines);
+	return NULL;
+}
+
+/* the len bytes at buf split into chunks at line ends, validated on
+   threads, with each chunk's output written in input order */
+int scanmapped(const char *buf, size_t len, int threads, scanfn each, sinkfn sink, struct scan *total)
+{
+	pthread_t *ids = calloc(threads, sizeof(pthread_t));
+	int started = 0, error = 0;
+
+	work.buf = buf;
+	work.len = len;
+	work.chunks = (len + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	work.next = work.written = 0;
+	work.window = threads * CHUNKS_AHEAD;
+	work.slots = calloc(work.window, sizeof(struct scan));
+	work.done = calloc(work.window, sizeof(size_t));
+	work.each = each;
+	work.sink = sink;
+	if (ids == NULL || work.slots == NULL || work.done == NULL)
+	{
+		fprintf(stderr, "error: cannot allocate memory\n");
+		return 1;
+	}
+	while (started < threads && pthread_create(&ids[started], NULL, worker, NULL) == 0)
+		started++;
+	if (started == 0)
+	{
+		fprintf(stderr, "error: cannot start threads\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < work.chunks; i++)
+	{
+		struct scan *s = &work.slots[i % work.window];
+		pthread_mutex_lock(&work.lock);
+		while (work.done[i % work.window] != i + 1)
+			pthread_cond_wait(&work.ready, &work.lock);
+		pthread_mutex_unlock(&work.lock);
+
+		/* on an error the rest are only counted, never written */
+		if (!error)
+			error = drain(s, work.sink, total);
+		s->outlen = 0;
+
+		pthread_mutex_lock(&work.lock);
+		work.written = i + 1;
+		pthread_cond_broadcast(&work.room);
+		pthread_mutex_unlock(&work.lock);
+	}
+	for (int t = 0; t < started; t++)
+		pthread_join(ids[t], NULL);
+	for (size_t w = 0; w < work.window; w++)
+		free(work.slots[w].out);
+	free(work.slots);
+	free(work.done);
+	free(ids);
+	return error;
+}
+
+/* map fd and scan it on threads, or read it if it cannot be mapped,
+   each runs on any thread, sink only ever on this one */
+int scanfile(int fd, int threads, scanfn each, sinkfn sink, struct scan *total)
+{
+	struct stat st;
+	char *buf;
+	int error;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+		(buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		return scanstream(fd, each, sink, total);
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
+	error = scanmapped(buf, st.st_size, threads, each, sink, total);
+	munmap(buf, st.st_size);
+	return error;
+}
@@ -0,0 +1,27 @@
+#define READ_SIZE (1 << 20)     /* input read at a time when it cannot be mapped */
+#define LINE_BATCH 4096
+#define CHUNK_SIZE (1 << 20)    /* mapped input a thread takes at a time */
+#define CHUNKS_AHEAD 2          /* per thread, done chunks that may wait to be written */
+
+struct ipline;
+
+/* what one stretch of the input came to: its counts and output, which
+   goes to stdout or a sink in input order */
+struct scan
+{
+    long long lines;
+    long long valid;
+    char *out;
+    size_t outlen;
+    size_t outcap;
+    int error;
+};
+
+typedef int (*scanfn)(struct ipline *lines, size_t n, struct scan *s);
+typedef int (*sinkfn)(const char *out, size_t len);
+
+char *outreserve(struct scan *s, size_t len);
+int writeall(int fd, const char *buf, size_t len);
+int scanstream(int fd, scanfn each, sinkfn sink, struct scan *total);
+int scanmapped(const char *buf, size_t len, int threads, scanfn each, sinkfn sink, struct scan *total);
+int scanfile(int fd, int threads, scanfn each, sinkfn sink, struct scan *total);
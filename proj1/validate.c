@@ -0,0 +1,91 @@
+// Benjamin Smith bxs566 validate.c
+// bulk ipv4 address validation, many lines of a buffer at a time
+
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "validate.h"
+
+/* the '\n' mask of the 16 bytes at p, which must all be readable */
+static inline unsigned newlines16(const char *p)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), _mm_set1_epi8('\n')));
+#else
+	unsigned newlines = 0;
+	for (int i = 0; i < 16; i++)
+		newlines |= (unsigned)(p[i] == '\n') << i;
+	return newlines;
+#endif
+}
+
+static inline int validateat(const char *s, size_t len, const char *end, uint32_t *addr)
+{
+	/* most lines can be read in place, only those at the very end are copied */
+	if (end - s >= 16)
+		return ipv4parse16(s, len, addr);
+	return ipv4parse(s, len, addr);
+}
+
+/* the '\n' mask of the 16 bytes at p, fewer if that reaches end */
+static inline unsigned newlinemask(const char *p, const char *end)
+{
+	char copy[16] = {0};
+
+	if (end - p >= 16)
+		return newlines16(p);
+	memcpy(copy, p, end - p);
+	return newlines16(copy);
+}
+
+/* validate up to max of the newline separated lines in buf, a last line
+   without a newline only counts at eof, the lines go to lines and their
+   number to n, returns how many bytes of buf they took */
+size_t validatelines(const char *buf, size_t len, int eof, struct ipline *lines, size_t max, size_t *n)
+{
+	const char *end = buf + len, *start = buf, *block = buf;
+	unsigned mask;
+	size_t k = 0;
+
+	if (len == 0 || max == 0)
+	{
+		*n = 0;
+		return 0;
+	}
+	/* a block's newlines are found at once, then each is taken in turn */
+	mask = newlinemask(block, end);
+	while (k < max)
+	{
+		while (mask == 0)
+		{
+			block += 16;
+			if (block >= end)
+				goto last;
+			mask = newlinemask(block, end);
+		}
+		const char *nl = block + __builtin_ctz(mask);
+		mask &= mask - 1;
+		lines[k].text = start;
+		lines[k].len = nl - start;
+		lines[k].valid = validateat(start, nl - start, end, &lines[k].addr);
+		lines[k].more = 0;
+		k++;
+		start = nl + 1;
+	}
+	*n = k;
+	return start - buf;
+
+last:
+	if (eof && start < end && k < max)
+	{
+		lines[k].text = start;
+		lines[k].len = end - start;
+		lines[k].valid = validateat(start, end - start, end, &lines[k].addr);
+		lines[k].more = 0;
+		k++;
+		start = end;
+	}
+	*n = k;
+	return start - buf;
+}
@@ -0,0 +1,15 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "ipv4.h"
+
+/* one line of a buffer and what it held */
+struct ipline
+{
+    const char *text;           /* not terminated, the newline is not part of it */
+    size_t len;
+    int valid;
+    int more;                   /* the line goes on in the next one, too long to hold */
+    uint32_t addr;              /* host order, only when valid */
+};
+
+size_t validatelines(const char *buf, size_t len, int eof, struct ipline *lines, size_t max, size_t *n);
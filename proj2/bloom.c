@@ -0,0 +1,47 @@
+// Ben Smith bloom.c Bloom filter for seen URLs
+
+#include <stdlib.h>
+#include "bloom.h"
+
+int bloominit(struct bloom *b, unsigned long long nbits, int k)
+{
+	b->nbits = nbits;
+	b->k = k;
+	b->bits = calloc((nbits + 63) / 64, sizeof(unsigned long long));
+	return (b->bits == NULL) ? -1 : 0;
+}
+
+/* FNV-1a, then a splitmix64 finish of it for the second hash, the k
+   positions are h1 + i * h2 (Kirsch and Mitzenmacher) */
+static void hashes(const char *s, int len, unsigned long long *h1, unsigned long long *h2)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	for (int i = 0; i < len; i++)
+		h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+	*h1 = h;
+	h += 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	*h2 = (h ^ (h >> 31)) | 1;
+}
+
+/* add s, returns 1 if it was not in the filter before */
+int bloomadd(struct bloom *b, const char *s, int len)
+{
+	unsigned long long h1, h2;
+	int fresh = 0;
+
+	hashes(s, len, &h1, &h2);
+	for (int i = 0; i < b->k; i++)
+	{
+		unsigned long long bit = (h1 + i * h2) % b->nbits;
+		unsigned long long mask = 1ULL << (bit & 63);
+		if (!(b->bits[bit >> 6] & mask))
+		{
+			fresh = 1;
+			b->bits[bit >> 6] |= mask;
+		}
+	}
+	return fresh;
+}
@@ -0,0 +1,14 @@
+#define BLOOMBITS (1ULL << 27)   /* 16 MiB, about 1% false positives at 14M URLs */
+#define BLOOMHASHES 7
+
+/* a Bloom filter, constant memory however many strings go in, at the
+   price of occasionally calling a new string seen */
+struct bloom
+{
+    unsigned long long *bits;
+    unsigned long long nbits;
+    int k;
+};
+
+int bloominit(struct bloom *b, unsigned long long nbits, int k);
+int bloomadd(struct bloom *b, const char *s, int len);
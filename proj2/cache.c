@@ -0,0 +1,281 @@
+// Ben Smith cache.c bodies kept between runs, revalidated with conditional requests
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "response.h"
+#include "fetch.h"
+#include "cache.h"
+
+/* an entry is two files named for a hash of its URL, the body and a .meta
+   holding the URL and its validators, the .meta's mtime is when the entry
+   was last used
+   a body is a hard link to the file it was fetched to where that works,
+   proj2 unlinks a file before writing it again so the link stays intact */
+static char cachedir[PATH_MAX];
+static long long maxsize, total = 0;
+static int ready = 0;
+
+struct entry
+{
+    char name[20];
+    long long size;
+    struct timespec used;
+};
+
+static void entryname(char *buf, size_t len, const char *url, const char *suffix)
+{
+	unsigned long long h = 14695981039346656037ULL;
+
+	for (const char *s = url; *s != '\0'; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	snprintf(buf, len, "%s/%016llx%s", cachedir, h, suffix);
+}
+
+/* copy from to the new file to, for when they cannot be linked */
+static int copyfile(const char *from, const char *to)
+{
+	int in, out, error = 0;
+	ssize_t n;
+	char buf[65536];
+
+	if ((in = open(from, O_RDONLY)) < 0)
+		return -1;
+	if ((out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	{
+		close(in);
+		return -1;
+	}
+	/* in kernel where the filesystem can, by reading and writing where not */
+	while ((n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0)
+		;
+	if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+	{
+		while ((n = read(in, buf, sizeof(buf))) > 0)
+		{
+			if (writeall(out, buf, n) < 0)
+				break;
+		}
+	}
+	if (n < 0 || close(out) < 0)
+		error = -1;
+	close(in);
+	if (error < 0)
+		unlink(to);
+	return error;
+}
+
+/* put a copy of from at to in one step, linked if possible */
+static int install(const char *from, const char *to)
+{
+	char tmp[PATH_MAX + 16];
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp%d", to, (int)getpid());
+	unlink(tmp);
+	if (link(from, tmp) < 0 && copyfile(from, tmp) < 0)
+		return -1;
+	/* renaming over a link to the same file does nothing, so tmp may
+	   still be there either way */
+	if (rename(tmp, to) < 0)
+	{
+		unlink(tmp);
+		return -1;
+	}
+	unlink(tmp);
+	return 0;
+}
+
+static int oldest(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+
+	if (x->used.tv_sec != y->used.tv_sec)
+		return (x->used.tv_sec < y->used.tv_sec) ? -1 : 1;
+	return (x->used.tv_nsec < y->used.tv_nsec) ? -1 : (x->used.tv_nsec > y->used.tv_nsec);
+}
+
+/* look at every entry, adding up their size, and if evicting remove the
+   least recently used until they fit in CACHEKEEP of the limit */
+static void scan(int evicting)
+{
+	struct entry *entries = NULL;
+	int n = 0, max = 0;
+	char path[PATH_MAX + 32];
+	struct dirent *d;
+	struct stat st;
+	DIR *dir;
+
+	if ((dir = opendir(cachedir)) == NULL)
+		return;
+	total = 0;
+	while ((d = readdir(dir)) != NULL)
+	{
+		size_t len = strlen(d->d_name);
+		if (len != 21 || strcmp(d->d_name + 16, ".meta") != 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%.21s", cachedir, d->d_name);
+		if (stat(path, &st) < 0)
+			continue;
+		if (n == max)
+		{
+			struct entry *more = realloc(entries, (max = max ? max * 2 : 256) * sizeof(struct entry));
+			if (more == NULL)
+				break;
+			entries = more;
+		}
+		memcpy(entries[n].name, d->d_name, 16);
+		entries[n].name[16] = '\0';
+		entries[n].used = st.st_mtim;
+		path[strlen(path) - 5] = '\0';
+		entries[n].size = (stat(path, &st) == 0) ? st.st_size : 0;
+		total += entries[n++].size;
+	}
+	closedir(dir);
+
+	if (evicting && total > maxsize)
+	{
+		qsort(entries, n, sizeof(struct entry), oldest);
+		for (int i = 0; i < n && total > maxsize * CACHEKEEP; i++)
+		{
+			/* the .meta first, a body without one is never used */
+			snprintf(path, sizeof(path), "%s/%s.meta", cachedir, entries[i].name);
+			unlink(path);
+			snprintf(path, sizeof(path), "%s/%s", cachedir, entries[i].name);
+			unlink(path);
+			total -= entries[i].size;
+		}
+	}
+	free(entries);
+}
+
+/* use the cache in dir, keeping about max bytes of bodies, returns 0 or -1 */
+int cacheopen(const char *dir, long long max)
+{
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "error: cannot create cache %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	snprintf(cachedir, sizeof(cachedir), "%s", dir);
+	maxsize = max;
+	ready = 1;
+	scan(1);
+	return 0;
+}
+
+/* read url's .meta into v, returns the body size or -1 if url is not
+   cached, or it is but another URL has its name */
+static long long readmeta(const char *url, struct validators *v)
+{
+	char meta[PATH_MAX + 32], body[PATH_MAX + 32], line[PATH_MAX];
+	long long size = -1;
+	size_t len = strlen(url);
+	struct stat st;
+	int ok;
+	FILE *f;
+
+	entryname(meta, sizeof(meta), url, ".meta");
+	entryname(body, sizeof(body), url, "");
+	if ((f = fopen(meta, "r")) == NULL)
+		return -1;
+	ok = fgets(line, sizeof(line), f) != NULL && strncmp(line, url, len) == 0 && line[len] == '\n' &&
+		fgets(v->etag, VALIDLEN, f) != NULL && fgets(v->lastmod, VALIDLEN, f) != NULL && fscanf(f, "%lld", &size) == 1;
+	fclose(f);
+	v->etag[strcspn(v->etag, "\n")] = '\0';
+	v->lastmod[strcspn(v->lastmod, "\n")] = '\0';
+
+	/* a body that is not the one described is no use */
+	if (!ok || stat(body, &st) < 0 || st.st_size != size)
+		return -1;
+	utimensat(AT_FDCWD, meta, NULL, 0);
+	return size;
+}
+
+/* the validators of url's cached body, returns 1 if it has one */
+int cachelookup(const char *url, struct validators *v)
+{
+	if (!ready)
+		return 0;
+	return readmeta(url, v) >= 0;
+}
+
+/* keep file, just fetched from url with response r, for next time
+   returns 0, or -1 if it could not be kept */
+int cachestore(const char *url, const char *file, struct response *r)
+{
+	char body[PATH_MAX + 32], meta[PATH_MAX + 32], tmp[PATH_MAX + 48];
+	const char *etag, *lastmod;
+	int etaglen = 0, lastmodlen = 0;
+	struct stat st, old;
+	FILE *f;
+
+	if (!ready)
+		return -1;
+	entryname(body, sizeof(body), url, "");
+	entryname(meta, sizeof(meta), url, ".meta");
+	etag = responseheader(r, "ETag", &etaglen);
+	lastmod = responseheader(r, "Last-Modified", &lastmodlen);
+
+	/* whatever was cached is out of date now, with no way to revalidate
+	   this version or no room for it, there is nothing to keep */
+	unlink(meta);
+	if (stat(body, &old) == 0)
+		total -= old.st_size;
+	unlink(body);
+	if ((etag == NULL && lastmod == NULL) || etaglen >= VALIDLEN || lastmodlen >= VALIDLEN || strchr(url, '\n') != NULL ||
+		stat(file, &st) < 0 || st.st_size > maxsize)
+		return -1;
+
+	if (install(file, body) < 0)
+		return -1;
+	snprintf(tmp, sizeof(tmp), "%s.tmp%d", meta, (int)getpid());
+	if ((f = fopen(tmp, "w")) == NULL)
+	{
+		unlink(body);
+		return -1;
+	}
+	fprintf(f, "%s\n%.*s\n%.*s\n%lld\n", url, etaglen, etag ? etag : "", lastmodlen, lastmod ? lastmod : "", (long long)st.st_size);
+	if (fclose(f) != 0 || rename(tmp, meta) < 0)
+	{
+		unlink(tmp);
+		unlink(body);
+		return -1;
+	}
+	if ((total += st.st_size) > maxsize)
+		scan(1);
+	return 0;
+}
+
+/* a 304 for url, put its cached body at file, returns its size or -1 */
+long long cacheplace(const char *url, const char *file)
+{
+	char body[PATH_MAX + 32];
+	struct validators v;
+	long long size;
+
+	if (!ready || (size = readmeta(url, &v)) < 0)
+		return -1;
+	entryname(body, sizeof(body), url, "");
+	if (install(body, file) < 0)
+		return -1;
+	return size;
+}
+
+/* the request headers that make a request for v's body conditional */
+int conditionalheaders(char *buf, int len, struct validators *v)
+{
+	int n = 0;
+
+	if (v->etag[0] != '\0')
+		n += snprintf(buf, len, "If-None-Match: %s\r\n", v->etag);
+	if (v->lastmod[0] != '\0' && n < len)
+		n += snprintf(buf + n, len - n, "If-Modified-Since: %s\r\n", v->lastmod);
+	return n;
+}
@@ -0,0 +1,18 @@
+#define CACHEMAX (256LL << 20)   /* default bytes of bodies kept */
+#define CACHEKEEP 0.9            /* eviction goes down to this share of the limit */
+#define VALIDLEN 256
+
+struct response;
+
+/* what was sent with a cached body, to ask the server whether it changed */
+struct validators
+{
+    char etag[VALIDLEN];
+    char lastmod[VALIDLEN];
+};
+
+int cacheopen(const char *dir, long long max);
+int cachelookup(const char *url, struct validators *v);
+int cachestore(const char *url, const char *file, struct response *r);
+long long cacheplace(const char *url, const char *file);
+int conditionalheaders(char *buf, int len, struct validators *v);
@@ -0,0 +1,128 @@
+// Ben Smith crawl.c follow links from seed pages, within the seeds' hosts
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "url.h"
+#include "response.h"
+#include "fetch.h"
+#include "bloom.h"
+#include "links.h"
+#include "crawl.h"
+
+/* the frontier is fetch's own per-host queues, which already keep each
+   host to its connection limit and politeness delay, so all a crawl
+   adds is the seen set and the scope */
+static struct bloom seen;
+static char scope[CRAWLSEEDS][HOSTLEN + PORTLEN + 8];
+static int nscope = 0;
+static int queued = 0;
+static int limit;
+static const char *page;
+
+/* the http://host:port part of url, and its length */
+static int authority(const char *url)
+{
+	return 7 + strcspn(url + 7, "/?#");
+}
+
+static int inscope(const char *url)
+{
+	int n = authority(url);
+
+	for (int i = 0; i < nscope; i++)
+	{
+		if ((int)strlen(scope[i]) == n && strncasecmp(scope[i], url, n) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* queue url unless it has been seen before, returns 1 if it was */
+static int visit(const char *url)
+{
+	if (queued >= limit || !bloomadd(&seen, url, strlen(url)))
+		return 0;
+	queued++;
+	return fetchadd(url) == 0;
+}
+
+static void foundlink(const char *link, int linklen, void *arg)
+{
+	char url[URLMAX];
+
+	if (resolvelink(page, link, linklen, url, sizeof(url)) < 0 || !inscope(url))
+		return;
+	visit(url);
+}
+
+/* only pages worth scanning for links, by Content-Type if the server
+   sends one and by the name otherwise */
+static int ishtml(const char *url, struct response *r)
+{
+	const char *type;
+	int len, n;
+
+	if ((type = responseheader(r, "Content-Type", &len)) != NULL)
+		return len >= 9 && strncasecmp(type, "text/html", 9) == 0;
+	n = authority(url);
+	n += strcspn(url + n, "?#");
+	if (url[n - 1] == '/' || n == authority(url))
+		return 1;
+	return (n > 5 && strncasecmp(url + n - 5, ".html", 5) == 0) || (n > 4 && strncasecmp(url + n - 4, ".htm", 4) == 0);
+}
+
+static void fetched(const char *url, const char *file, struct response *r)
+{
+	struct stat st;
+	char *html;
+	int fd;
+
+	if (!ishtml(url, r) || (fd = open(file, O_RDONLY)) < 0)
+		return;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		html = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (html != MAP_FAILED)
+		{
+			page = url;
+			extractlinks(html, st.st_size, foundlink, NULL);
+			munmap(html, st.st_size);
+		}
+	}
+	close(fd);
+}
+
+/* fetch the seeds and every page reachable from them on their hosts,
+   at most maxpages in all, returns how many could not be fetched */
+int crawl(char **seeds, int nseeds, struct fetchopts *o, int maxpages)
+{
+	char url[URLMAX];
+
+	if (bloominit(&seen, BLOOMBITS, BLOOMHASHES) < 0)
+	{
+		fprintf(stderr, "error: cannot allocate the seen set\n");
+		return nseeds;
+	}
+	limit = maxpages;
+	o->done = fetched;
+	if (fetchstart(o) < 0)
+		return nseeds;
+	for (int i = 0; i < nseeds; i++)
+	{
+		/* a seed is resolved against itself to tidy it the same way links are */
+		if (resolvelink(seeds[i], seeds[i], strlen(seeds[i]), url, sizeof(url)) < 0)
+		{
+			fprintf(stderr, "error: %s: not an http URL\n", seeds[i]);
+			continue;
+		}
+		if (!inscope(url) && nscope < CRAWLSEEDS)
+			snprintf(scope[nscope++], sizeof(scope[0]), "%.*s", authority(url), url);
+		visit(url);
+	}
+	return fetchfinish();
+}
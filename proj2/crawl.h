@@ -0,0 +1,4 @@
+#define CRAWLMAX 100000       /* default limit on pages fetched by a crawl */
+#define CRAWLSEEDS 16         /* most hosts a crawl will stay within */
+
+int crawl(char **seeds, int nseeds, struct fetchopts *o, int maxpages);
@@ -0,0 +1,133 @@
+// Ben Smith eyeballs.c happy eyeballs connects across address families
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "resolve.h"
+#include "eyeballs.h"
+#include "timing.h"
+
+/* start the attempt at the next address, returns -1 if there is none */
+static int attempt(struct race *r, struct addrs *a, double now)
+{
+	int i = r->started, sd;
+
+	if (i >= a->n)
+		return -1;
+	r->started++;
+	r->nexttry = now + EYEBALLDELAY;
+	r->sd[i] = -1;
+	if ((sd = socket(a->addr[i].ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+	{
+		r->error = errno;
+		return 0;
+	}
+	if (connect(sd, (struct sockaddr *)&a->addr[i], a->len[i]) < 0 && errno != EINPROGRESS)
+	{
+		r->error = errno;
+		close(sd);
+		return 0;
+	}
+	r->sd[i] = sd;
+	return 0;
+}
+
+void racestart(struct race *r, struct addrs *a, double now)
+{
+	r->started = r->added = 0;
+	r->error = (a->n > 0) ? 0 : EHOSTUNREACH;
+	attempt(r, a, now);
+}
+
+/* see how the attempts are doing and start the next when it is due,
+   returns the first connected socket, which the race gives up, -1 while
+   still racing or -2 with errno set when every address failed */
+int racestep(struct race *r, struct addrs *a, double now)
+{
+	struct pollfd p[MAXADDRS];
+	int n = 0, live = 0, err, winner = -1;
+	socklen_t errlen = sizeof(err);
+
+	for (int i = 0; i < r->started; i++)
+	{
+		p[n].fd = r->sd[i];    /* poll skips the failed ones at -1 */
+		p[n++].events = POLLOUT;
+	}
+	if (poll(p, n, 0) < 0)
+		n = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (r->sd[i] < 0 || p[i].revents == 0)
+			continue;
+		if (getsockopt(r->sd[i], SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err != 0)
+		{
+			r->error = err;
+			close(r->sd[i]);
+			r->sd[i] = -1;
+		}
+		else if (winner < 0)
+		{
+			winner = r->sd[i];
+			r->sd[i] = -1;
+		}
+	}
+	if (winner >= 0)
+	{
+		raceabort(r);
+		return winner;
+	}
+
+	/* a failure starts the next address at once, otherwise it waits its turn */
+	for (int i = 0; i < r->started; i++)
+		live += (r->sd[i] >= 0);
+	while ((live == 0 || now >= r->nexttry) && r->started < a->n)
+	{
+		attempt(r, a, now);
+		live += (r->sd[r->started - 1] >= 0);
+		if (live > 0)
+			break;
+	}
+	if (live == 0)
+	{
+		errno = r->error;
+		return -2;
+	}
+	return -1;
+}
+
+void raceabort(struct race *r)
+{
+	for (int i = 0; i < r->started; i++)
+	{
+		if (r->sd[i] >= 0)
+			close(r->sd[i]);
+		r->sd[i] = -1;
+	}
+}
+
+/* a blocking connect to whichever address answers first */
+int eyeballs(struct addrs *a)
+{
+	struct pollfd p[MAXADDRS];
+	struct race r;
+	int sd, n, wait;
+
+	racestart(&r, a, monotonic());
+	while ((sd = racestep(&r, a, monotonic())) == -1)
+	{
+		for (n = 0; n < r.started; n++)
+		{
+			p[n].fd = r.sd[n];
+			p[n].events = POLLOUT;
+		}
+		wait = (r.started < a->n) ? (int)((r.nexttry - monotonic()) * 1000) + 1 : -1;
+		poll(p, n, (wait < 0 && r.started < a->n) ? 0 : wait);
+	}
+	if (sd < 0)
+		return -1;
+	/* the caller expects a blocking socket */
+	fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) & ~O_NONBLOCK);
+	return sd;
+}
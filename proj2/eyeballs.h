@@ -0,0 +1,17 @@
+#define EYEBALLDELAY 0.25    /* seconds before the next address joins the race (RFC 8305) */
+
+/* non-blocking connects to a list of addresses, each started when the
+   one before has failed or had EYEBALLDELAY to answer */
+struct race
+{
+    int sd[MAXADDRS];           /* -1 once an attempt failed */
+    int started;
+    int added;                  /* attempts the caller has seen, for epoll */
+    double nexttry;
+    int error;                  /* errno of the latest failure */
+};
+
+void racestart(struct race *r, struct addrs *a, double now);
+int racestep(struct race *r, struct addrs *a, double now);
+void raceabort(struct race *r);
+int eyeballs(struct addrs *a);
@@ -0,0 +1,1226 @@
+// Ben Smith fetch.c fetch many URLs at once from one epoll loop
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "url.h"
+#include "response.h"
+#include "resolve.h"
+#include "eyeballs.h"
+#include "timing.h"
+#include "fetch.h"
+#include "cache.h"
+
+#define HOSTBUCKETS 1024
+#define REQLEN 16384
+#define READLEN 65536
+#define MAXEVENTS 256
+#define USERAGENT "Case CSDS 325/425 WebClient 0.1"
+
+struct job
+{
+    const char *url;
+    const char *path;           /* inside url */
+    struct host *host;
+    struct job *next;           /* in the host's queue */
+    int tries;
+    const char *file;           /* body file, NULL to name it from the URL */
+    int out;                    /* file shared by a segmented download, else -1 */
+    long long start;            /* range still wanted, end -1 for the whole body */
+    long long end;
+    int owned;                  /* allocated by fetchadd, freed once reported */
+    int conditional;            /* sent with the cached body's validators, -1 never to be */
+};
+
+/* everything fetched from one host:port, jobs wait here until one of the
+   host's connections has room for them */
+struct host
+{
+    char name[HOSTLEN];
+    char port[PORTLEN];
+    struct addrs addrs;
+    int resolving;
+    int resolved;               /* addrs holds the answer, n 0 if it failed */
+    int active;                 /* connections open, idle ones included */
+    int idle;
+    int noreuse;                /* the server closed after a response, stop pipelining */
+    double nextstart;           /* politeness, no new request before this */
+    struct job *head;
+    struct job *tail;
+    int ready;                  /* on the ready list */
+    struct host *readynext;
+    struct host *hashnext;
+};
+
+/* a connection and the requests pipelined on it, responses come back in
+   the order of pipe */
+struct fconn
+{
+    int sd;
+    int inuse;
+    int connecting;             /* racing connects, sd not yet chosen */
+    struct race race;
+    struct host *host;
+    struct job *pipe[PIPEMAX];
+    int pipehead;
+    int npipe;
+    int served;                 /* responses completed on this connection */
+    int parked;                 /* on the idle list */
+    char req[REQLEN];           /* requests not yet sent */
+    int reqlen;
+    int reqsent;
+    int out;                    /* body file, -1 until a wanted body starts */
+    char outname[PATH_MAX];
+    long long written;          /* bytes of this body in the file */
+    struct response rsp;
+    struct fconn *next;         /* free list or idle list */
+    struct fconn *prev;
+};
+
+static struct fetchopts *opts;
+static int ep;
+static struct host *buckets[HOSTBUCKETS];
+static struct host *readyhead = NULL, *readytail = NULL;
+static struct fconn *freeconns = NULL;
+static struct fconn idlelist;   /* list head, oldest at the tail */
+static struct fconn *conns;
+static int resolvefd, resolving = 0, connecting = 0;
+static int active = 0, idle = 0, failed = 0, fetched = 0, reused = 0;
+static long long totalbytes = 0;
+static char readbuf[READLEN];
+static int pipefd[2] = {-1, -1};
+static int nosplice = 0;
+
+static unsigned int hashhost(const char *name, const char *port)
+{
+	unsigned int h = 2166136261u;
+
+	for (; *name; name++)
+		h = (h ^ (unsigned char)*name) * 16777619u;
+	for (; *port; port++)
+		h = (h ^ (unsigned char)*port) * 16777619u;
+	return h % HOSTBUCKETS;
+}
+
+/* the host entry for u, created unresolved the first time it is seen */
+static struct host *findhost(struct url *u)
+{
+	unsigned int b = hashhost(u->host, u->port);
+	struct host *h;
+
+	for (h = buckets[b]; h != NULL; h = h->hashnext)
+	{
+		if (strcmp(h->name, u->host) == 0 && strcmp(h->port, u->port) == 0)
+			return h;
+	}
+	if ((h = calloc(1, sizeof(struct host))) == NULL)
+		return NULL;
+	strcpy(h->name, u->host);
+	strcpy(h->port, u->port);
+	h->hashnext = buckets[b];
+	buckets[b] = h;
+	return h;
+}
+
+/* queue h for a connection if it has work and may get one */
+static void makeready(struct host *h)
+{
+	if (h->ready || h->head == NULL || !h->resolved || (h->active >= opts->perhost && h->idle == 0))
+		return;
+	h->ready = 1;
+	h->readynext = NULL;
+	if (readytail == NULL)
+		readyhead = h;
+	else
+		readytail->readynext = h;
+	readytail = h;
+}
+
+static void enqueue(struct host *h, struct job *j)
+{
+	j->next = NULL;
+	if (h->tail == NULL)
+		h->head = j;
+	else
+		h->tail->next = j;
+	h->tail = j;
+}
+
+static struct job *dequeue(struct host *h)
+{
+	struct job *j = h->head;
+
+	h->head = j->next;
+	if (h->head == NULL)
+		h->tail = NULL;
+	return j;
+}
+
+/* dir/host[_port]/path with the slashes flattened, index.html for a directory */
+static void outname(char *name, size_t len, struct job *j)
+{
+	struct host *h = j->host;
+	size_t n;
+
+	n = snprintf(name, len, "%s/%s", opts->dir, h->name);
+	if (n < len && strcmp(h->port, DEFPORT) != 0)
+		n += snprintf(name + n, len - n, "_%s", h->port);
+	for (const char *p = j->path; *p != '\0' && n < len - 1; p++)
+		name[n++] = (*p == '/') ? '_' : *p;
+	name[n] = '\0';
+	if (name[n - 1] == '_')
+		snprintf(name + n, len - n, "index.html");
+}
+
+/* where j's body goes */
+static void filename(char *name, size_t len, struct job *j)
+{
+	if (j->file != NULL)
+		snprintf(name, len, "%s", j->file);
+	else
+		outname(name, len, j);
+}
+
+static void report(struct job *j, int status, const char *error, const char *file, long long bytes)
+{
+	if (error == NULL)
+	{
+		printf("%d %lld %s %s\n", status, bytes, j->url, file);
+		fetched++;
+		totalbytes += bytes;
+	}
+	else if (status != 0)
+	{
+		fprintf(stderr, "error: %s: %d %s\n", j->url, status, error);
+		failed++;
+	}
+	else
+	{
+		fprintf(stderr, "error: %s: %s\n", j->url, error);
+		failed++;
+	}
+	if (j->owned)
+		free(j);
+}
+
+static void unidle(struct fconn *c)
+{
+	c->parked = 0;
+	c->prev->next = c->next;
+	c->next->prev = c->prev;
+	c->host->idle--;
+	idle--;
+}
+
+/* done with the body file of the response at the head of the pipe,
+   a failed one is removed unless segments of it are still coming */
+static void closeout(struct fconn *c, int failed)
+{
+	if (c->out < 0)
+		return;
+	if (c->pipe[c->pipehead]->out < 0)
+	{
+		close(c->out);
+		if (failed)
+			unlink(c->outname);
+	}
+	c->out = -1;
+}
+
+/* what the response to j should be */
+static int wantstatus(struct job *j)
+{
+	return (j->end >= 0) ? 206 : 200;
+}
+
+/* put every request still waiting on c back at the front of its host's queue */
+static void requeue(struct fconn *c)
+{
+	struct host *h = c->host;
+
+	for (int i = c->npipe - 1; i >= 0; i--)
+	{
+		struct job *j = c->pipe[(c->pipehead + i) % PIPEMAX];
+		j->next = h->head;
+		h->head = j;
+		if (h->tail == NULL)
+			h->tail = j;
+	}
+	c->npipe = 0;
+}
+
+static void closeconn(struct fconn *c)
+{
+	struct host *h = c->host;
+
+	if (c->parked)
+		unidle(c);
+	if (c->connecting)
+	{
+		raceabort(&c->race);
+		c->connecting = 0;
+		connecting--;
+	}
+	c->inuse = 0;
+	closeout(c, 1);
+	requeue(c);
+	close(c->sd);
+	c->next = freeconns;
+	freeconns = c;
+	active--;
+	h->active--;
+	makeready(h);
+}
+
+/* the response at the head of the pipe is over, error says why it failed */
+static void complete(struct fconn *c, const char *error)
+{
+	struct job *j = c->pipe[c->pipehead];
+
+	long long bytes = c->rsp.received;
+
+	if (error == NULL && c->rsp.status == 304 && j->conditional > 0)
+	{
+		/* unchanged, the cached body is the answer */
+		filename(c->outname, sizeof(c->outname), j);
+		if ((bytes = cacheplace(j->url, c->outname)) < 0)
+			error = "cached body gone";
+	}
+	else if (error == NULL && c->rsp.status != wantstatus(j))
+		error = (j->end >= 0) ? "range not served" : "not 200 OK";
+	closeout(c, error != NULL);
+	if (error != NULL && c->rsp.status == 304)
+	{
+		/* evicted since it was asked for, ask again for all of it */
+		j->conditional = -1;
+		enqueue(j->host, j);
+		makeready(j->host);
+	}
+	else
+	{
+		if (error == NULL && c->rsp.status == 200 && j->end < 0 && opts->cache != NULL)
+			cachestore(j->url, c->outname, &c->rsp);
+		if (error == NULL && opts->done != NULL)
+			opts->done(j->url, c->outname, &c->rsp);
+		report(j, c->rsp.status, error, c->outname, bytes);
+	}
+	c->written = 0;
+	c->pipehead = (c->pipehead + 1) % PIPEMAX;
+	c->npipe--;
+	c->served++;
+	if (c->served > 1)
+		reused++;
+}
+
+/* a connection that failed under j, give up on it after FETCHTRIES
+   attempts that got nowhere, a segment resumes from what it has written */
+static void retry(struct fconn *c, const char *error)
+{
+	struct job *j = c->pipe[c->pipehead];
+
+	if (c->npipe == 0)
+		return;
+	if (j->out >= 0 && c->written > 0)
+	{
+		j->start += c->written;
+		c->written = 0;
+		return;
+	}
+	if (++j->tries < FETCHTRIES)
+		return;
+	closeout(c, 1);
+	report(j, c->rsp.status, error, NULL, 0);
+	c->pipehead = (c->pipehead + 1) % PIPEMAX;
+	c->npipe--;
+}
+
+int writeall(int fd, const char *buf, int len)
+{
+	while (len > 0)
+	{
+		int n = write(fd, buf, len);
+		if (n < 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int pwriteall(int fd, const char *buf, int len, long long off)
+{
+	while (len > 0)
+	{
+		int n = pwrite(fd, buf, len, off);
+		if (n < 0)
+			return -1;
+		buf += n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/* the pipe may still hold body that could not be written, close it so
+   none of that reaches the next connection's file, keeping errno */
+static void droppipe(void)
+{
+	int error = errno;
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+	pipefd[0] = pipefd[1] = -1;
+	errno = error;
+}
+
+/* move up to len bytes of body (all there is if len < 0) from sd to out,
+   at *off if off is not NULL, through a pipe so it never passes through
+   user space
+   returns the bytes moved, 0 at EOF, or -1 with EINVAL if splice cannot
+   be used here and the caller should read instead */
+long splicebody(int sd, int out, long long *off, long long len)
+{
+	long n, m, moved = 0;
+
+	if (nosplice)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (pipefd[0] < 0)
+	{
+		if (pipe2(pipefd, O_CLOEXEC) < 0)
+		{
+			nosplice = 1;
+			errno = EINVAL;
+			return -1;
+		}
+		fcntl(pipefd[1], F_SETPIPE_SZ, SPLICELEN);
+	}
+	if (len < 0 || len > SPLICELEN)
+		len = SPLICELEN;
+	if ((n = splice(sd, NULL, pipefd[1], NULL, len, SPLICE_F_MOVE)) <= 0)
+	{
+		if (n < 0 && errno == EINVAL)
+			nosplice = 1;
+		return n;
+	}
+
+	/* the pipe is emptied every time so one serves every connection */
+	while (moved < n)
+	{
+		if ((m = splice(pipefd[0], NULL, out, (loff_t *)off, n - moved, SPLICE_F_MOVE)) > 0)
+		{
+			moved += m;
+			continue;
+		}
+		if (m == 0)
+			errno = EIO;
+		if (m == 0 || errno != EINVAL)
+		{
+			droppipe();
+			return -1;
+		}
+		/* out cannot take a splice, copy what is already in the pipe */
+		nosplice = 1;
+		while (moved < n && (m = read(pipefd[0], readbuf, (n - moved < READLEN) ? n - moved : READLEN)) > 0)
+		{
+			if (((off == NULL) ? writeall(out, readbuf, m) : pwriteall(out, readbuf, m, *off)) < 0)
+			{
+				droppipe();
+				return -1;
+			}
+			moved += m;
+			if (off != NULL)
+				*off += m;
+		}
+		if (moved < n)
+		{
+			if (m == 0)
+				errno = EIO;
+			droppipe();
+			return -1;
+		}
+	}
+	return n;
+}
+
+/* body bytes of a wanted response, the file is opened with the first
+   of them, a segment goes at its offset in the shared file */
+static const char *body(struct fconn *c, const char *buf, int len)
+{
+	struct job *j = c->pipe[c->pipehead];
+
+	if (c->out < 0 && j->out >= 0)
+	{
+		c->out = j->out;
+		snprintf(c->outname, sizeof(c->outname), "%s", j->file);
+	}
+	else if (c->out < 0)
+	{
+		filename(c->outname, sizeof(c->outname), j);
+		/* it may be a link to a cached body, which must stay as it is */
+		if (opts->cache != NULL)
+			unlink(c->outname);
+		if ((c->out = open(c->outname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+			return strerror(errno);
+	}
+	if (((j->out >= 0) ? pwriteall(c->out, buf, len, j->start + c->written) : writeall(c->out, buf, len)) < 0)
+		return strerror(errno);
+	c->written += len;
+	return NULL;
+}
+
+static int formatrequest(char *buf, int len, struct job *j)
+{
+	struct host *h = j->host;
+	const char *version = opts->keepalive ? "1.1" : "1.0";
+	int v6 = (strchr(h->name, ':') != NULL);
+	char extra[2 * VALIDLEN + 64] = "";
+	struct validators v;
+
+	/* a segment asks for its range, a cached URL whether it has changed */
+	if (j->end >= 0)
+		snprintf(extra, sizeof(extra), "Range: bytes=%lld-%lld\r\n", j->start, j->end);
+	else if (opts->cache != NULL && j->conditional >= 0 && cachelookup(j->url, &v))
+	{
+		conditionalheaders(extra, sizeof(extra), &v);
+		j->conditional = 1;
+	}
+	if (strcmp(h->port, DEFPORT) == 0)
+		return snprintf(buf, len, "GET %s HTTP/%s\r\nHost: %s%s%s\r\nUser-Agent: %s\r\n%s\r\n", j->path, version, v6 ? "[" : "",
+			h->name, v6 ? "]" : "", USERAGENT, extra);
+	return snprintf(buf, len, "GET %s HTTP/%s\r\nHost: %s%s%s:%s\r\nUser-Agent: %s\r\n%s\r\n", j->path, version, v6 ? "[" : "",
+		h->name, v6 ? "]" : "", h->port, USERAGENT, extra);
+}
+
+/* pipeline as many of the host's queued requests on c as it may carry */
+static void fill(struct fconn *c)
+{
+	struct host *h = c->host;
+	int depth = (opts->keepalive && !h->noreuse) ? opts->depth : 1;
+
+	if (!opts->keepalive && c->served > 0)
+		return;
+	if (c->reqsent > 0)
+	{
+		memmove(c->req, c->req + c->reqsent, c->reqlen - c->reqsent);
+		c->reqlen -= c->reqsent;
+		c->reqsent = 0;
+	}
+	while (c->npipe < depth && h->head != NULL)
+	{
+		int n;
+
+		/* a polite host gets one request at a time, spaced out */
+		if (opts->delay > 0)
+		{
+			double now = monotonic();
+			if (c->npipe > 0 || now < h->nextstart)
+				break;
+			h->nextstart = now + opts->delay;
+		}
+		n = formatrequest(c->req + c->reqlen, REQLEN - c->reqlen, h->head);
+		if (n >= REQLEN - c->reqlen)
+		{
+			if (c->reqlen > 0)
+				break;
+			report(dequeue(h), 0, "URL too long", NULL, 0);
+			continue;
+		}
+		c->reqlen += n;
+		c->pipe[(c->pipehead + c->npipe) % PIPEMAX] = dequeue(h);
+		c->npipe++;
+	}
+}
+
+static int flush(struct fconn *c)
+{
+	while (c->reqsent < c->reqlen)
+	{
+		int n = send(c->sd, c->req + c->reqsent, c->reqlen - c->reqsent, MSG_NOSIGNAL);
+		if (n < 0)
+			return (errno == EAGAIN) ? 0 : -1;
+		c->reqsent += n;
+	}
+	return 0;
+}
+
+/* c has nothing in flight, keep it for its host's next requests */
+static void park(struct fconn *c)
+{
+	c->parked = 1;
+	c->next = idlelist.next;
+	c->prev = &idlelist;
+	idlelist.next->prev = c;
+	idlelist.next = c;
+	c->host->idle++;
+	idle++;
+	makeready(c->host);
+}
+
+/* the response at the head of the pipe is complete, move on to the next
+   one or park or close c, returns -1 if c was closed */
+static int nextresponse(struct fconn *c)
+{
+	complete(c, NULL);
+	if (!c->rsp.keepalive || !opts->keepalive)
+	{
+		if (!c->rsp.keepalive)
+			c->host->noreuse = 1;
+		closeconn(c);
+		return -1;
+	}
+	responseinit(&c->rsp);
+	fill(c);
+	if (flush(c) < 0)
+	{
+		closeconn(c);
+		return -1;
+	}
+	if (c->npipe == 0)
+		park(c);
+	return 0;
+}
+
+/* feed read bytes to the responses in the pipe, returns -1 if c was closed */
+static int consume(struct fconn *c, const char *buf, int len)
+{
+	struct job *j;
+	const char *data, *error;
+	int used, datalen;
+
+	while (len > 0)
+	{
+		if (c->npipe == 0)
+		{
+			closeconn(c);    /* nothing was asked for */
+			return -1;
+		}
+		j = c->pipe[c->pipehead];
+		if (c->rsp.state == RSP_HEAD)
+		{
+			used = responsehead(&c->rsp, buf, len);
+			buf += used;
+			len -= used;
+			if (c->rsp.state == RSP_HEAD)
+				return 0;
+			if (c->rsp.state == RSP_ERROR)
+			{
+				complete(c, "bad response header");
+				closeconn(c);
+				return -1;
+			}
+			/* interim responses come before the real one */
+			if (c->rsp.status / 100 == 1)
+			{
+				responseinit(&c->rsp);
+				continue;
+			}
+			/* a 1.0 connection is not worth draining for anything unwanted */
+			if (!opts->keepalive && c->rsp.status != wantstatus(j))
+			{
+				complete(c, NULL);
+				closeconn(c);
+				return -1;
+			}
+			if (c->rsp.status == 206 && j->end >= 0 && responserange(&c->rsp, NULL) != j->start)
+			{
+				complete(c, "wrong range served");
+				closeconn(c);
+				return -1;
+			}
+			/* open the file now so the rest can be spliced into it */
+			if (c->rsp.status == wantstatus(j) && (error = body(c, buf, 0)) != NULL)
+			{
+				complete(c, error);
+				closeconn(c);
+				return -1;
+			}
+		}
+		if (c->rsp.state == RSP_BODY)
+		{
+			used = responsebody(&c->rsp, buf, len, &data, &datalen);
+			buf += used;
+			len -= used;
+			if (c->rsp.state == RSP_ERROR)
+			{
+				complete(c, "bad chunked body");
+				closeconn(c);
+				return -1;
+			}
+			if (c->rsp.status == wantstatus(j) && datalen > 0 && (error = body(c, data, datalen)) != NULL)
+			{
+				complete(c, error);
+				closeconn(c);
+				return -1;
+			}
+		}
+		if (c->rsp.state == RSP_DONE && nextresponse(c) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* move c's connect race along, returns 0 once it has a socket, 1 while
+   still racing or -1 with errno set when every address failed */
+static int race(struct fconn *c)
+{
+	struct race *r = &c->race;
+	struct epoll_event ev;
+	int sd = racestep(r, &c->host->addrs, monotonic());
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.data.ptr = c;
+	if (sd == -2)
+		return -1;
+	if (sd >= 0)
+	{
+		/* the winner may have connected before it was ever watched */
+		if (epoll_ctl(ep, EPOLL_CTL_ADD, sd, &ev) < 0 && errno != EEXIST)
+		{
+			close(sd);
+			return -1;
+		}
+		c->sd = sd;
+		c->connecting = 0;
+		connecting--;
+		return 0;
+	}
+	for (; r->added < r->started; r->added++)
+	{
+		if (r->sd[r->added] >= 0)
+			epoll_ctl(ep, EPOLL_CTL_ADD, r->sd[r->added], &ev);
+	}
+	return 1;
+}
+
+/* run c as far as its socket allows, the socket is edge triggered so each
+   step goes until it would block */
+static void advance(struct fconn *c)
+{
+	int n;
+
+	/* a losing connect attempt can leave a stale event behind */
+	if (!c->inuse)
+		return;
+	if (c->connecting && (n = race(c)) != 0)
+	{
+		if (n < 0)
+		{
+			retry(c, strerror(errno));
+			closeconn(c);
+		}
+		return;
+	}
+	if (flush(c) < 0)
+	{
+		retry(c, strerror(errno));
+		return closeconn(c);
+	}
+	for (;;)
+	{
+		/* a 200 with plain framing goes from the socket to its file
+		   directly, everything else is read and parsed */
+		if (c->out >= 0 && c->rsp.state == RSP_BODY && !c->rsp.chunked)
+		{
+			struct job *j = c->pipe[c->pipehead];
+			long long off = j->start + c->written;
+			n = splicebody(c->sd, c->out, (j->out >= 0) ? &off : NULL, c->rsp.length < 0 ? -1 : c->rsp.length - c->rsp.received);
+			if (n > 0)
+			{
+				c->written += n;
+				if ((c->rsp.received += n) == c->rsp.length)
+				{
+					c->rsp.state = RSP_DONE;
+					if (nextresponse(c) < 0)
+						return;
+				}
+				continue;
+			}
+			if (n == 0 || errno == EAGAIN)
+				break;
+			if (errno != EINVAL)
+			{
+				complete(c, strerror(errno));
+				return closeconn(c);
+			}
+		}
+		if ((n = read(c->sd, readbuf, READLEN)) <= 0)
+			break;
+		if (consume(c, readbuf, n) < 0)
+			return;
+	}
+	if (n < 0 && errno == EAGAIN)
+		return;
+
+	/* EOF, or an error, ends the connection */
+	if (n == 0 && c->npipe > 0 && responseend(&c->rsp) == 0)
+	{
+		complete(c, NULL);
+		c->host->noreuse = 1;
+	}
+	else if (c->npipe > 0 && (c->rsp.headlen > 0 || c->served == 0))
+	{
+		/* a kept-alive connection the server closed before answering
+		   is normal, the requests just go again on another */
+		retry(c, (n == 0) ? "connection closed early" : strerror(errno));
+	}
+	closeconn(c);
+}
+
+/* a new connection to h, connecting to its addresses happy eyeballs
+   style, NULL if every one failed right away */
+static struct fconn *connectto(struct host *h)
+{
+	struct fconn *c = freeconns;
+
+	freeconns = c->next;
+	c->host = h;
+	c->inuse = 1;
+	c->sd = -1;
+	c->connecting = 1;
+	connecting++;
+	c->out = -1;
+	c->written = 0;
+	c->reqlen = c->reqsent = 0;
+	c->pipehead = c->npipe = 0;
+	c->served = 0;
+	c->parked = 0;
+	responseinit(&c->rsp);
+	active++;
+	h->active++;
+
+	racestart(&c->race, &h->addrs, monotonic());
+	if (race(c) >= 0)
+		return c;
+	report(dequeue(h), 0, strerror(errno), NULL, 0);
+	closeconn(c);
+	return NULL;
+}
+
+/* give ready hosts connections round robin so one busy host cannot
+   starve the rest, preferring the host's own idle ones, then free slots,
+   then closing whichever idle connection has waited longest */
+static void schedule()
+{
+	struct host *laterhead = NULL, *latertail = NULL;
+	double now = monotonic();
+
+	while (readyhead != NULL)
+	{
+		struct host *h = readyhead;
+		struct fconn *c = NULL;
+
+		/* hosts still owed a politeness delay wait their turn */
+		if (h->nextstart > now)
+		{
+			readyhead = h->readynext;
+			if (readyhead == NULL)
+				readytail = NULL;
+			h->readynext = NULL;
+			if (latertail == NULL)
+				laterhead = h;
+			else
+				latertail->readynext = h;
+			latertail = h;
+			continue;
+		}
+		if (h->idle > 0)
+		{
+			for (c = idlelist.next; c->host != h; c = c->next)
+				;
+			unidle(c);
+		}
+		else
+		{
+			if (freeconns == NULL && idle > 0)
+			{
+				struct fconn *old = idlelist.prev;
+				closeconn(old);
+			}
+			if (freeconns == NULL)
+				break;
+		}
+
+		readyhead = h->readynext;
+		if (readyhead == NULL)
+			readytail = NULL;
+		h->ready = 0;
+		if (c == NULL && (c = connectto(h)) == NULL)
+			continue;
+		fill(c);
+		if (c->npipe == 0 || (!c->connecting && flush(c) < 0))
+			closeconn(c);
+		makeready(h);
+	}
+	if (laterhead != NULL)
+	{
+		if (readytail == NULL)
+			readyhead = laterhead;
+		else
+			readytail->readynext = laterhead;
+		readytail = latertail;
+	}
+}
+
+/* milliseconds until the first waiting host may be sent a request */
+static int politetimeout(double now)
+{
+	double soonest = -1;
+
+	for (struct host *h = readyhead; h != NULL; h = h->readynext)
+	{
+		if (soonest < 0 || h->nextstart < soonest)
+			soonest = h->nextstart;
+	}
+	if (soonest < 0)
+		return -1;
+	return (soonest > now) ? (int)((soonest - now) * 1000) + 1 : 0;
+}
+
+static int setup(struct fetchopts *o)
+{
+	struct epoll_event ev;
+
+	opts = o;
+	if (o->depth > PIPEMAX)
+		o->depth = PIPEMAX;
+	idlelist.next = idlelist.prev = &idlelist;
+	if ((ep = epoll_create1(0)) < 0)
+		return -1;
+	if ((resolvefd = resolverinit(RESOLVERS)) < 0)
+	{
+		fprintf(stderr, "error: cannot start resolver threads\n");
+		close(ep);
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;    /* lookups finished */
+	epoll_ctl(ep, EPOLL_CTL_ADD, resolvefd, &ev);
+	if ((conns = calloc(o->maxconns, sizeof(struct fconn))) == NULL)
+	{
+		fprintf(stderr, "error: cannot allocate %d connections\n", o->maxconns);
+		close(ep);
+		return -1;
+	}
+	for (int i = o->maxconns - 1; i >= 0; i--)
+	{
+		conns[i].next = freeconns;
+		freeconns = &conns[i];
+	}
+	return 0;
+}
+
+/* jobs for a host that could not be resolved all fail with it */
+static void hostfailed(struct host *h)
+{
+	while (h->head != NULL)
+		report(dequeue(h), 0, gai_strerror(h->addrs.error), NULL, 0);
+}
+
+/* look up h on the resolver threads unless the answer is cached */
+static void lookuphost(struct host *h)
+{
+	switch (resolve(h->name, h->port, h, &h->addrs))
+	{
+	case 0:
+		h->resolved = 1;
+		break;
+	case 1:
+		h->resolving = 1;
+		resolving++;
+		break;
+	default:
+		h->addrs.n = 0;
+		h->addrs.error = EAI_MEMORY;
+		h->resolved = 1;
+	}
+}
+
+static void resolved()
+{
+	struct addrs a;
+	void *data;
+
+	while (resolvedone(&data, &a))
+	{
+		struct host *h = data;
+		memcpy(&h->addrs, &a, sizeof(struct addrs));
+		h->resolved = 1;
+		h->resolving = 0;
+		resolving--;
+		if (h->addrs.n == 0)
+			hostfailed(h);
+		makeready(h);
+	}
+}
+
+/* milliseconds until a connect race is due its next address, -1 if none */
+static int racetimeout(double now)
+{
+	double soonest = -1;
+
+	for (int i = 0; connecting > 0 && i < opts->maxconns; i++)
+	{
+		struct fconn *c = &conns[i];
+		if (c->inuse && c->connecting && c->race.started < c->host->addrs.n && (soonest < 0 || c->race.nexttry < soonest))
+			soonest = c->race.nexttry;
+	}
+	if (soonest < 0)
+		return -1;
+	return (soonest > now) ? (int)((soonest - now) * 1000) + 1 : 0;
+}
+
+/* run every queued job to completion */
+static void run()
+{
+	struct epoll_event events[MAXEVENTS];
+
+	schedule();
+	while (active > idle || resolving > 0 || readyhead != NULL)
+	{
+		double now = monotonic();
+		int wait = racetimeout(now), polite = politetimeout(now);
+		int n = epoll_wait(ep, events, MAXEVENTS, (wait < 0 || (polite >= 0 && polite < wait)) ? polite : wait);
+		if (n < 0 && errno != EINTR)
+			break;
+		for (int i = 0; i < n; i++)
+		{
+			if (events[i].data.ptr == NULL)
+				resolved();
+			else
+				advance(events[i].data.ptr);
+		}
+		/* races whose current attempt has had its time */
+		for (int i = 0; connecting > 0 && i < opts->maxconns; i++)
+		{
+			if (conns[i].inuse && conns[i].connecting && monotonic() >= conns[i].race.nexttry)
+				advance(&conns[i]);
+		}
+		schedule();
+	}
+	while (idle > 0)
+		closeconn(idlelist.next);
+	close(ep);
+	free(conns);
+}
+
+static void initjob(struct job *j, const char *url)
+{
+	memset(j, 0x0, sizeof(struct job));
+	j->url = url;
+	j->out = -1;
+	j->end = -1;
+}
+
+static int added = 0;
+static double began;
+
+/* get ready to fetch with fetchadd, returns 0 or -1 */
+int fetchstart(struct fetchopts *o)
+{
+	began = monotonic();
+	if (mkdir(o->dir, 0755) < 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "error: cannot create %s: %s\n", o->dir, strerror(errno));
+		return -1;
+	}
+	if (o->cache != NULL && cacheopen(o->cache, o->cachemax) < 0)
+		return -1;
+	return setup(o);
+}
+
+/* queue url, which may be called from the done callback while fetching,
+   returns -1 if it was rejected at once */
+int fetchadd(const char *url)
+{
+	size_t len = strlen(url);
+	struct job *j = malloc(sizeof(struct job) + len + 1);
+	struct host *h;
+	struct url u;
+
+	added++;
+	if (j == NULL)
+	{
+		fprintf(stderr, "error: %s: cannot allocate fetch\n", url);
+		failed++;
+		return -1;
+	}
+	memcpy(j + 1, url, len + 1);
+	initjob(j, (char *)(j + 1));
+	j->owned = 1;
+	if (parseurl(j->url, &u) < 0)
+	{
+		report(j, 0, "bad URL", NULL, 0);
+		return -1;
+	}
+	j->path = u.path;
+	if ((h = j->host = findhost(&u)) == NULL)
+	{
+		report(j, 0, "cannot allocate host", NULL, 0);
+		return -1;
+	}
+	if (!h->resolved && !h->resolving)
+		lookuphost(h);
+	enqueue(h, j);
+	if (h->resolved && h->addrs.n == 0)
+	{
+		hostfailed(h);
+		return -1;
+	}
+	makeready(h);
+	return 0;
+}
+
+/* fetch everything added, and all that is added meanwhile, returns how
+   many could not be fetched */
+int fetchfinish()
+{
+	run();
+	fprintf(stderr, "fetched %d of %d URLs, %lld bytes in %.3f s", fetched, added, totalbytes, monotonic() - began);
+	if (opts->keepalive)
+		fprintf(stderr, ", %d over reused connections", reused);
+	fprintf(stderr, "\n");
+	return failed;
+}
+
+/* fetch every URL, each 200 body to its own file under o->dir
+   returns how many could not be fetched */
+int fetchall(char **urls, int nurls, struct fetchopts *o)
+{
+	if (fetchstart(o) < 0)
+		return nurls;
+	for (int i = 0; i < nurls; i++)
+		fetchadd(urls[i]);
+	return fetchfinish();
+}
+
+/* ask j's host for the first byte of it to learn its size and whether
+   ranges are served, returns the size, 0 if it must be fetched whole,
+   or -1 */
+static long long probe(struct job *j, int *ranges)
+{
+	struct host *h = j->host;
+	struct response *r;
+	char req[REQLEN];
+	long long size = -1;
+	int sd, n = 1;
+
+	j->start = j->end = 0;
+	if ((r = malloc(sizeof(struct response))) == NULL)
+		return -1;
+	responseinit(r);
+	if ((sd = eyeballs(&h->addrs)) < 0 || send(sd, req, formatrequest(req, REQLEN, j), MSG_NOSIGNAL) < 0)
+	{
+		fprintf(stderr, "error: %s: %s\n", j->url, strerror(errno));
+		n = -1;
+	}
+	while (n > 0 && r->state == RSP_HEAD && (n = read(sd, readbuf, READLEN)) > 0)
+		responsehead(r, readbuf, n);
+	close(sd);
+
+	*ranges = 0;
+	if (r->state == RSP_HEAD || r->state == RSP_ERROR)
+	{
+		if (n >= 0)
+			fprintf(stderr, "error: %s: no usable response to the size probe\n", j->url);
+	}
+	else if (r->status == 206 && responserange(r, &size) == 0 && size > 0)
+		*ranges = 1;
+	else if (r->status == 200 || r->status == 206 || r->status == 416)
+		size = 0;    /* ranges are no use, fetch it whole */
+	else
+		fprintf(stderr, "error: %s: %d from the size probe\n", j->url, r->status);
+	free(r);
+	return size;
+}
+
+/* fetch one URL into file as up to nsegs byte ranges over parallel
+   connections, each written at its offset in the preallocated file
+   returns 0 on success */
+int fetchsegmented(char *url, const char *file, int nsegs, struct fetchopts *o)
+{
+	struct job *jobs, probejob;
+	struct url u;
+	long long size, each;
+	int ranges, out = -1;
+	double began = monotonic();
+
+	opts = o;
+	if (parseurl(url, &u) < 0)
+	{
+		fprintf(stderr, "error: %s: bad URL\n", url);
+		return 1;
+	}
+	initjob(&probejob, url);
+	probejob.path = u.path;
+	if ((probejob.host = findhost(&u)) == NULL || resolvewait(u.host, u.port, &probejob.host->addrs) != 0)
+	{
+		fprintf(stderr, "error: %s: cannot find host %s\n", url, u.host);
+		return 1;
+	}
+	probejob.host->resolved = 1;
+	if ((size = probe(&probejob, &ranges)) < 0)
+		return 1;
+
+	/* segments too small are not worth their connections */
+	if (!ranges)
+		nsegs = 1;
+	else if (nsegs > size / SEGMIN)
+		nsegs = (size / SEGMIN > 0) ? size / SEGMIN : 1;
+	o->maxconns = o->perhost = nsegs;
+	o->depth = 1;
+	if ((jobs = calloc(nsegs, sizeof(struct job))) == NULL || setup(o) < 0)
+		return 1;
+
+	if (ranges)
+	{
+		if ((out = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+		{
+			fprintf(stderr, "error: cannot open file %s: %s\n", file, strerror(errno));
+			return 1;
+		}
+		if (posix_fallocate(out, 0, size) != 0 && ftruncate(out, size) < 0)
+		{
+			fprintf(stderr, "error: cannot allocate %lld bytes for %s\n", size, file);
+			return 1;
+		}
+	}
+	each = size / nsegs;
+	for (int i = 0; i < nsegs; i++)
+	{
+		initjob(&jobs[i], url);
+		jobs[i].path = u.path;
+		jobs[i].host = probejob.host;
+		jobs[i].file = file;
+		if (ranges)
+		{
+			jobs[i].out = out;
+			jobs[i].start = i * each;
+			jobs[i].end = (i == nsegs - 1) ? size - 1 : (i + 1) * each - 1;
+		}
+		enqueue(jobs[i].host, &jobs[i]);
+	}
+	makeready(probejob.host);
+	run();
+
+	if (out >= 0 && close(out) < 0)
+		failed++;
+	if (failed > 0)
+		unlink(file);
+	else
+		fprintf(stderr, "fetched %lld bytes in %d segments in %.3f s\n", size, nsegs, monotonic() - began);
+	free(jobs);
+	return failed;
+}
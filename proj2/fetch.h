@@ -0,0 +1,30 @@
+#define FETCHCONNS 32        /* default limit on connections open at once */
+#define FETCHPERHOST 4       /* default limit on connections to one host */
+#define FETCHDEPTH 8         /* default requests in flight on one keep-alive connection */
+#define PIPEMAX 64
+#define FETCHTRIES 3         /* attempts at a URL whose connection keeps failing */
+#define SPLICELEN (1 << 20)  /* most body moved by one splice */
+#define SEGMIN (1 << 20)     /* smallest range worth its own connection */
+
+struct response;
+
+struct fetchopts
+{
+    const char *dir;            /* where bodies are written */
+    int maxconns;
+    int perhost;
+    int keepalive;              /* HTTP/1.1, reusing and pipelining connections */
+    int depth;
+    double delay;               /* seconds between requests to one host */
+    void (*done)(const char *url, const char *file, struct response *r);
+    const char *cache;          /* directory of bodies kept between runs, or NULL */
+    long long cachemax;
+};
+
+int fetchstart(struct fetchopts *o);
+int fetchadd(const char *url);
+int fetchfinish();
+int fetchall(char **urls, int nurls, struct fetchopts *o);
+int fetchsegmented(char *url, const char *file, int nsegs, struct fetchopts *o);
+int writeall(int fd, const char *buf, int len);
+long splicebody(int sd, int out, long long *off, long long len);
@@ -0,0 +1,171 @@
+// Ben Smith links.c pull links out of HTML and resolve them against the page
+
+#include <string.h>
+#include <strings.h>
+#include "links.h"
+
+#define SCHEME "http://"
+
+/* is the attribute named name at html[i], as a whole word */
+static int isattr(const char *html, size_t len, size_t i, const char *name)
+{
+	size_t n = strlen(name);
+
+	if (i == 0 || i + n >= len || strncasecmp(html + i, name, n) != 0)
+		return 0;
+	return html[i - 1] == ' ' || html[i - 1] == '\t' || html[i - 1] == '\n' || html[i - 1] == '\r';
+}
+
+/* call found with the value of every href and src attribute, a plain scan
+   with no HTML parser behind it so it also finds them in comments */
+void extractlinks(const char *html, size_t len, void (*found)(const char *link, int linklen, void *arg), void *arg)
+{
+	for (size_t i = 1; i < len; i++)
+	{
+		size_t j;
+		char quote;
+
+		if ((html[i] | 0x20) != 'h' && (html[i] | 0x20) != 's')
+			continue;
+		if (isattr(html, len, i, "href"))
+			j = i + 4;
+		else if (isattr(html, len, i, "src"))
+			j = i + 3;
+		else
+			continue;
+		while (j < len && html[j] == ' ')
+			j++;
+		if (j >= len || html[j] != '=')
+			continue;
+		j++;
+		while (j < len && html[j] == ' ')
+			j++;
+		if (j >= len)
+			break;
+
+		quote = (html[j] == '"' || html[j] == '\'') ? html[j++] : 0;
+		i = j;
+		while (j < len && (quote ? html[j] != quote : (html[j] != ' ' && html[j] != '>' && html[j] != '\t' && html[j] != '\n')))
+			j++;
+		if (j > i && j - i < URLMAX)
+			found(html + i, j - i, arg);
+		i = j;
+	}
+}
+
+/* drop . and .. segments from the path that starts at out[from], in place */
+static int normalize(char *out, int from, int len)
+{
+	int r = from, w = from, pathend;
+
+	pathend = from + strcspn(out + from, "?");
+	while (r < pathend)
+	{
+		/* r is at a '/', look at the segment after it */
+		int seg = r + 1, end = seg;
+		while (end < pathend && out[end] != '/')
+			end++;
+		if (end - seg == 1 && out[seg] == '.')
+		{
+			if (end == pathend)
+				out[w++] = '/';
+		}
+		else if (end - seg == 2 && out[seg] == '.' && out[seg + 1] == '.')
+		{
+			while (w > from && out[--w] != '/')
+				;
+			if (end == pathend)
+				out[w++] = '/';
+		}
+		else
+		{
+			memmove(out + w, out + r, end - r);
+			w += end - r;
+		}
+		r = end;
+	}
+	if (w == from)
+		out[w++] = '/';
+	memmove(out + w, out + pathend, len - pathend + 1);
+	return w + (len - pathend);
+}
+
+/* the absolute http URL that link on page base refers to, without any
+   fragment, returns its length or -1 for another scheme or no room */
+int resolvelink(const char *base, const char *link, int linklen, char *out, int outlen)
+{
+	const char *colon, *basepath;
+	int authority, n, keep;
+
+	/* the fragment is the page's own business */
+	if ((colon = memchr(link, '#', linklen)) != NULL)
+		linklen = colon - link;
+	while (linklen > 0 && (*link == ' ' || *link == '\n'))
+	{
+		link++;
+		linklen--;
+	}
+	if (linklen == 0)
+		return -1;
+
+	if (linklen >= 7 && strncasecmp(link, SCHEME, 7) == 0)
+	{
+		if (linklen >= outlen)
+			return -1;
+		memcpy(out, SCHEME, 7);
+		memcpy(out + 7, link + 7, linklen - 7);
+		n = linklen;
+	}
+	else
+	{
+		/* any other scheme, mailto: https: javascript: and the like */
+		colon = memchr(link, ':', linklen);
+		if (colon != NULL && strcspn(link, "/?") > (size_t)(colon - link))
+			return -1;
+		if (strncasecmp(base, SCHEME, 7) != 0)
+			return -1;
+		authority = 7 + strcspn(base + 7, "/?#");
+		basepath = base + authority;
+
+		if (linklen >= 2 && link[0] == '/' && link[1] == '/')
+			keep = 5;    /* http: then the link's own authority */
+		else if (link[0] == '/')
+			keep = authority;
+		else if (link[0] == '?')
+			keep = authority + strcspn(basepath, "?#");
+		else
+		{
+			/* relative to the directory of the base path */
+			int pathlen = strcspn(basepath, "?#");
+			keep = authority;
+			for (int i = 0; i < pathlen; i++)
+			{
+				if (basepath[i] == '/')
+					keep = authority + i + 1;
+			}
+		}
+		if (keep + linklen + 1 >= outlen)
+			return -1;
+		memcpy(out, base, keep);
+		n = keep;
+		if (keep == authority && link[0] != '/' && link[0] != '?')
+			out[n++] = '/';
+		if (keep == authority && link[0] == '?')
+			out[n++] = '/';
+		memcpy(out + n, link, linklen);
+		n += linklen;
+	}
+	out[n] = '\0';
+
+	/* and the path of the result, "/" if it has none */
+	authority = 7 + strcspn(out + 7, "/?");
+	if (out[authority] != '/')
+	{
+		if (n + 1 >= outlen)
+			return -1;
+		memmove(out + authority + 1, out + authority, n - authority + 1);
+		out[authority] = '/';
+		n++;
+	}
+	return normalize(out, authority, n);
+}
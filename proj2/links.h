@@ -0,0 +1,4 @@
+#define URLMAX 2048
+
+void extractlinks(const char *html, size_t len, void (*found)(const char *link, int linklen, void *arg), void *arg);
+int resolvelink(const char *base, const char *link, int linklen, char *out, int outlen);
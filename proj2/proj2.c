@@ -3,38 +3,72 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include "url.h"
+#include "response.h"
+#include "resolve.h"
+#include "eyeballs.h"
+#include "fetch.h"
+#include "timing.h"
+#include "crawl.h"
+#include "cache.h"
 
 #define ERROR 1
 #define ARG_INFO 0x0
 #define ARG_PRINTHEAD 0x1
 #define ARG_PRINTREQ 0x2
-#define PROTO "tcp"
-#define BUFLEN 1024
+#define BUFLEN 65536
 #define HTTP "http://"
-#define OK "200 OK"
-#define HEAD_END "\r\n\r\n"
-#define HTTP_PORT 80
 
 char *outfilename = NULL;
-FILE *outfile;
 unsigned short cmd_line_flags = 0;
 char *url = NULL;
-char *header = NULL;
 char *hostname;
+char *port;
 char *path;
+struct url target;
+struct response rsp;
+char *urlfile = NULL;
+int segments = 0;
+int timing = 0;
+int repeat = 1;
+int crawling = 0;
+int maxpages = CRAWLMAX;
+struct fetchopts fetchopts = {".", FETCHCONNS, FETCHPERHOST, 0, FETCHDEPTH, 0, NULL, NULL, CACHEMAX};
+int conditional = 0; /* 1 when validators went with the request, -1 once they must not */
 
 void usage(char *progname)
 {
-	fprintf(stderr, "%s [-i] [-q] [-a] -u URL -w filename\n", progname);
+	fprintf(stderr, "%s [-i] [-q] [-a] [-T] [-n N] [-C cache] -u URL -w filename\n", progname);
+	fprintf(stderr, "%s -s segments -u URL -w filename [-k]\n", progname);
+	fprintf(stderr, "%s -f urlfile [-d dir] [-C cache] [-c conns] [-p perhost] [-k [-P depth]]\n", progname);
+	fprintf(stderr, "%s -r {-u URL | -f urlfile} [-m pages] [-D ms] [-d dir] [-c conns] [-p perhost] [-k]\n", progname);
 	fprintf(stderr, "    -i    print debugging info\n");
 	fprintf(stderr, "    -q    print HTTP request\n");
 	fprintf(stderr, "    -a    print HTTP response header\n");
 	fprintf(stderr, "    -u X  specify request URL \'X\'\n");
 	fprintf(stderr, "    -w X  specify output file \'X\'\n");
+	fprintf(stderr, "    -T    time dns, connect, ttfb (request sent to first byte),\n");
+	fprintf(stderr, "          header (first byte to header end) and body of each fetch\n");
+	fprintf(stderr, "    -n N  fetch N times, then print min/median/p99 of each phase\n");
+	fprintf(stderr, "    -s N  fetch the URL as N byte ranges over parallel connections\n");
+	fprintf(stderr, "    -f X  fetch every URL listed in file \'X\' concurrently\n");
+	fprintf(stderr, "    -d X  write the fetched bodies under directory \'X\' (default .)\n");
+	fprintf(stderr, "    -c N  open at most N connections at once (default %d)\n", FETCHCONNS);
+	fprintf(stderr, "    -p N  open at most N connections to one host (default %d)\n", FETCHPERHOST);
+	fprintf(stderr, "    -k    use HTTP/1.1 and reuse each host's connections\n");
+	fprintf(stderr, "    -P N  pipeline up to N requests on a connection with -k (default %d)\n", FETCHDEPTH);
+	fprintf(stderr, "    -r    crawl, following links from the URL or URLs on their hosts\n");
+	fprintf(stderr, "    -m N  crawl at most N pages (default %d)\n", CRAWLMAX);
+	fprintf(stderr, "    -D N  wait N ms between requests to one host\n");
+	fprintf(stderr, "    -C X  keep bodies in directory 'X' and only fetch them again if changed\n");
+	fprintf(stderr, "    -M N  keep at most N MB in the -C cache (default %lld)\n", CACHEMAX >> 20);
 	exit(ERROR);
 }
 
@@ -42,7 +76,7 @@ void parseargs(int argc, char *argv[])
 {
 	int opt;
 
-	while ((opt = getopt(argc, argv, "iqau:w:")) != -1)
+	while ((opt = getopt(argc, argv, "iqau:w:f:d:c:p:kP:s:Tn:rm:D:C:M:")) != -1)
 	{
 		switch (opt)
 		{
@@ -61,6 +95,48 @@ void parseargs(int argc, char *argv[])
 		case 'w':
 			outfilename = optarg;
 			break;
+		case 'f':
+			urlfile = optarg;
+			break;
+		case 'd':
+			fetchopts.dir = optarg;
+			break;
+		case 'c':
+			fetchopts.maxconns = atoi(optarg);
+			break;
+		case 'p':
+			fetchopts.perhost = atoi(optarg);
+			break;
+		case 'k':
+			fetchopts.keepalive = 1;
+			break;
+		case 'P':
+			fetchopts.depth = atoi(optarg);
+			break;
+		case 's':
+			segments = atoi(optarg);
+			break;
+		case 'T':
+			timing = 1;
+			break;
+		case 'n':
+			repeat = atoi(optarg);
+			break;
+		case 'r':
+			crawling = 1;
+			break;
+		case 'm':
+			maxpages = atoi(optarg);
+			break;
+		case 'D':
+			fetchopts.delay = atof(optarg) / 1000;
+			break;
+		case 'C':
+			fetchopts.cache = optarg;
+			break;
+		case 'M':
+			fetchopts.cachemax = atoll(optarg) << 20;
+			break;
 		case '?':
 		default:
 			usage(argv[0]);
@@ -94,7 +170,7 @@ void printrequest(char *request)
 
 void printresponse()
 {
-	char *header_copy = strdup(header);
+	char *header_copy = strdup(rsp.head);
 	char *line;
 	if (header_copy == NULL)
 		errexit("error: cannot print response header", NULL);
@@ -113,143 +189,177 @@ void printresponse()
 
 int sethostinfo(char *arg_url)
 {
-	char *pathpart;
-
 	// check starts with http://
 	if (strncasecmp(arg_url, HTTP, strlen(HTTP)) != 0)
 		errexit("error: URL must start with %s", HTTP);
-	else
-	{
-		hostname = arg_url + strlen(HTTP);
-		if (strcmp(hostname, "") == 0)
-			errexit("error: cannot find hostname in URL: %s", arg_url);
-	}
-
-	// find hostname
-	hostname = strtok(hostname, "/");
-	if (hostname == NULL)
+	if (parseurl(arg_url, &target) < 0)
 		errexit("error: cannot find hostname in URL: %s", arg_url);
-	else
-	{
-		pathpart = strdup(hostname);
-		char *pathpart_ptr = pathpart;
-		path = malloc(strlen(hostname));
-		pathpart = strtok(NULL, "/");
-		while (pathpart != NULL)
-		{
-			strcat(path, "/");
-			strcat(path, pathpart);
-			pathpart = strtok(NULL, "/");
-		}
-		strcat(path, "/");
-		free(pathpart_ptr);
-	}
-
+	hostname = target.host;
+	port = target.port;
+	path = (char *)target.path;
 	return 0;
 }
 
 int makesocket(char *request)
 {
-	struct sockaddr_in sin;
-	struct hostent *hinfo;
-	struct protoent *protoinfo;
+	struct addrs addrs;
 	int sd;
 
-	/* lookup the hostname */
-	hinfo = gethostbyname(hostname);
-	if (hinfo == NULL)
+	/* lookup the hostname, cached after the first time */
+	if (resolvewait(hostname, port, &addrs) != 0)
 		errexit("error: cannot find host: %s", hostname);
+	mark(PH_DNS);
 
-	/* set endpoint information */
-	memset((char *)&sin, 0x0, sizeof(sin));
-	sin.sin_family = AF_INET;
-	sin.sin_port = htons(HTTP_PORT);
-	memcpy((char *)&sin.sin_addr, hinfo->h_addr, hinfo->h_length);
-
-	if ((protoinfo = getprotobyname(PROTO)) == NULL)
-		errexit("error: cannot find protocol information for %s", PROTO);
-
-	/* allocate a socket */
-	sd = socket(PF_INET, SOCK_STREAM, protoinfo->p_proto);
-	if (sd < 0)
-		errexit("error: cannot create socket", NULL);
-
-	/* connect the socket */
-	if (connect(sd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+	/* connect to whichever address answers first */
+	if ((sd = eyeballs(&addrs)) < 0)
 		errexit("error: cannot connect socket", NULL);
+	mark(PH_CONNECT);
 
-	send(sd, request, strlen(request), 0);
+	if (send(sd, request, strlen(request), MSG_NOSIGNAL) < 0)
+		errexit("error: cannot send request", NULL);
 	return sd;
 }
 
 char *buildrequest()
 {
-	char *request = malloc(sizeof(path) + sizeof(hostname) + 80);
-	sprintf(request, "GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: Case CSDS 325/425 WebClient 0.1\r\n\r\n", path, hostname);
+	int v6 = (strchr(hostname, ':') != NULL);
+	char *request = malloc(strlen(path) + strlen(hostname) + strlen(port) + 2 * VALIDLEN + 160);
+	char validators[2 * VALIDLEN + 64] = "";
+	struct validators v;
+
+	if (request == NULL)
+		errexit("error: cannot allocate request", NULL);
+	if (conditional >= 0 && fetchopts.cache != NULL && outfilename != NULL && cachelookup(url, &v))
+	{
+		conditionalheaders(validators, sizeof(validators), &v);
+		conditional = 1;
+	}
+	sprintf(request, "GET %s HTTP/1.0\r\nHost: %s%s%s%s%s\r\nUser-Agent: Case CSDS 325/425 WebClient 0.1\r\n%s\r\n", path, v6 ? "[" : "",
+		hostname, v6 ? "]" : "", strcmp(port, DEFPORT) == 0 ? "" : ":", strcmp(port, DEFPORT) == 0 ? "" : port, validators);
 	return request;
 }
 
+/* decode len bytes of body from buf and write them out */
+void copybody(int out, const char *buf, int len)
+{
+	const char *data;
+	int used, datalen;
+
+	while (len > 0 && rsp.state == RSP_BODY)
+	{
+		used = responsebody(&rsp, buf, len, &data, &datalen);
+		if (rsp.state == RSP_ERROR)
+			errexit("error: bad chunked body", NULL);
+		if (writeall(out, data, datalen) < 0)
+			errexit("error: cannot write file %s", outfilename);
+		buf += used;
+		len -= used;
+	}
+}
+
+/* find the end of the header as it arrives, then stream the body to
+   outfilename byte for byte, spliced straight from the socket unless it
+   is chunked, returns -1 if a 304 came but the cached body is gone */
 int writeoutfile(int sd)
 {
-	char buffer[BUFLEN];
-	size_t header_size = 0;
-	int out, isheader;
+	static char buffer[BUFLEN];
+	int n = 0, used = 0, out;
+	long moved;
 
-	isheader = 1;
-	memset(buffer, 0x0, BUFLEN);
+	responseinit(&rsp);
+	while (rsp.state == RSP_HEAD)
+	{
+		if ((n = read(sd, buffer, BUFLEN)) < 0)
+			errexit("error: cannot read socket", NULL);
+		if (n == 0)
+			errexit("error: connection closed in response header", NULL);
+		if (rsp.headlen == 0)
+			mark(PH_TTFB);
+		used = responsehead(&rsp, buffer, n);
+	}
+	mark(PH_HEADER);
+	if (rsp.state == RSP_ERROR)
+		errexit("error: bad response header", NULL);
+	if (rsp.status == 304 && conditional > 0)
+	{
+		/* unchanged since it was cached, unless it was evicted since */
+		if (cacheplace(url, outfilename) < 0)
+			return -1;
+		mark(PH_BODY);
+		return 0;
+	}
+	if (rsp.status != 200)
+	{
+		mark(PH_BODY);
+		return 0;
+	}
 
-	while ((out = read(sd, buffer, BUFLEN - 1)) > 0)
+	if (outfilename == NULL)
+		errexit("error: filename required", NULL);
+	/* it may be a link to a cached body, which must stay as it is */
+	if (fetchopts.cache != NULL)
+		unlink(outfilename);
+	if ((out = open(outfilename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		errexit("error: cannot open file %s", outfilename);
+	copybody(out, buffer + used, n - used);
+	while (rsp.state == RSP_BODY)
 	{
-		buffer[out] = '\0';
-		if (isheader)
+		if (!rsp.chunked && (moved = splicebody(sd, out, NULL, rsp.length < 0 ? -1 : rsp.length - rsp.received)) >= 0)
 		{
-			header = realloc(header, header_size + out + 1);
-			if (header == NULL)
-				errexit("error: could not allocate header", NULL);
-			memcpy(header + header_size, buffer, out);
-			header_size += out;
-			header[header_size] = '\0';
-
-			char *header_end = strstr(header, HEAD_END);
-			if (header_end != NULL)
-			{
-				isheader = 0;
-				header_end += 4; // skip last \r\n\r\n
-				if (strstr(header, OK) != NULL)  // 200 response
-				{
-					if (outfilename == NULL)
-					{
-						fprintf(stderr, "error: filename required\n");
-					}
-					outfile = fopen(outfilename, "w+");
-					if (outfile == NULL)
-					{
-						fprintf(stderr, "error: cannot open file %s\n", outfilename);
-						exit(ERROR);
-					}
-					fprintf(outfile, "%s", header_end);
-				}
-			}
+			if (moved == 0 && responseend(&rsp) < 0)
+				errexit("error: body truncated", NULL);
+			if (moved > 0 && (rsp.received += moved) == rsp.length)
+				rsp.state = RSP_DONE;
+			continue;
 		}
-		else if (outfile != NULL)
-		{
-			fprintf(outfile, "%s", buffer);
-		}
-		memset(buffer, 0x0, BUFLEN);
+		if (!rsp.chunked && errno != EINVAL)
+			errexit("error: cannot stream body to %s", outfilename);
+		if ((n = read(sd, buffer, BUFLEN)) < 0)
+			errexit("error: cannot read socket", NULL);
+		if (n == 0 && responseend(&rsp) < 0)
+			errexit("error: body truncated", NULL);
+		copybody(out, buffer, n);
 	}
-	
-	if (out < 0)
-		errexit("error: cannot read socket", NULL);
-	if (outfile != NULL)
-		fclose(outfile);
+	close(out);
+	if (fetchopts.cache != NULL)
+		cachestore(url, outfilename, &rsp);
+	mark(PH_BODY);
 	return 0;
 }
 
+/* fetch the URL repeat times, timing each, then print what flag asks for */
 int sendrequest(int flag)
 {
+	struct timing *runs = calloc(repeat, sizeof(struct timing));
 	char *req = buildrequest();
-	int sd = makesocket(req);
-	writeoutfile(sd);
+	int sd;
+
+	if (runs == NULL)
+		errexit("error: cannot allocate %s timings", "repeat");
+	for (int i = 0; i < repeat; i++)
+	{
+		timingstart();
+		sd = makesocket(req);
+		if (writeoutfile(sd) < 0)
+		{
+			/* the cached body went away after the validators were sent,
+			   so fetch it again without them */
+			close(sd);
+			conditional = -1;
+			free(req);
+			req = buildrequest();
+			sd = makesocket(req);
+			writeoutfile(sd);
+		}
+		close(sd);
+		timingresult(&runs[i], rsp.received);
+		if (timing)
+			printtiming(&runs[i]);
+	}
+	if (repeat > 1)
+		printtimings(runs, repeat);
+	free(runs);
+
 	if (flag == ARG_INFO)
 		printinfo();
 	else if (flag == ARG_PRINTHEAD)
@@ -259,22 +369,85 @@ int sendrequest(int flag)
 	else
 		errexit("error: specify a flag", NULL);
 
-	close(sd);
 	free(req);
-	free(header);
 	return 0;
 }
 
+/* one URL per line, blank lines and # comments skipped */
+char **readurls(char *filename, int *nurls)
+{
+	FILE *f = fopen(filename, "r");
+	char **urls = NULL;
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	int n = 0, max = 0;
+
+	if (f == NULL)
+		errexit("error: cannot open URL file %s", filename);
+	while ((len = getline(&line, &cap, f)) >= 0)
+	{
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' '))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+		if (n == max)
+		{
+			max = max ? max * 2 : 64;
+			if ((urls = realloc(urls, max * sizeof(char *))) == NULL)
+				errexit("error: cannot allocate URL list", NULL);
+		}
+		if ((urls[n++] = strdup(line)) == NULL)
+			errexit("error: cannot allocate URL list", NULL);
+	}
+	free(line);
+	fclose(f);
+	*nurls = n;
+	return urls;
+}
+
 int main(int argc, char *argv[])
 {
 	parseargs(argc, argv);
 	int error = 0;
 
+	if (fetchopts.maxconns < 1 || fetchopts.perhost < 1 || fetchopts.depth < 1)
+		errexit("error: connection limits and pipeline depth must be at least 1", NULL);
+
+	if (crawling)
+	{
+		int nurls = 1;
+		char **urls = &url;
+		if (urlfile != NULL)
+			urls = readurls(urlfile, &nurls);
+		else if (url == NULL)
+			errexit("error: -r needs a URL or a URL file", NULL);
+		if (maxpages < 1)
+			errexit("error: -m needs at least %s page", "1");
+		exit(crawl(urls, nurls, &fetchopts, maxpages) > 0 ? ERROR : 0);
+	}
+
+	if (urlfile != NULL)
+	{
+		int nurls;
+		char **urls = readurls(urlfile, &nurls);
+		exit(fetchall(urls, nurls, &fetchopts) > 0 ? ERROR : 0);
+	}
+
 	if (url == NULL)
 	{
 		fprintf(stderr, "error: URL required\n");
 		usage(argv[0]);
 	}
+	if (repeat < 1)
+		errexit("error: -n needs at least %s run", "1");
+
+	if (segments > 0)
+	{
+		if (outfilename == NULL)
+			errexit("error: filename required", NULL);
+		exit(fetchsegmented(url, outfilename, segments, &fetchopts) > 0 ? ERROR : 0);
+	}
 
 	if (url == NULL)
 	{
@@ -285,6 +458,8 @@ int main(int argc, char *argv[])
 	{
 		sethostinfo(url);
 	}
+	if (fetchopts.cache != NULL && cacheopen(fetchopts.cache, fetchopts.cachemax) < 0)
+		exit(ERROR);
 
 	if (cmd_line_flags == ARG_INFO)
 	{
@@ -0,0 +1,249 @@
+// Ben Smith resolve.c getaddrinfo on a thread pool behind a TTL cache
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "url.h"
+#include "resolve.h"
+
+struct lookup
+{
+    char host[HOSTLEN];
+    char port[PORTLEN];
+    void *data;
+    struct addrs addrs;
+    struct lookup *next;
+};
+
+struct cached
+{
+    char host[HOSTLEN];
+    char port[PORTLEN];
+    time_t expires;
+    struct addrs addrs;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static struct lookup *todo = NULL, *todotail = NULL, *done = NULL;
+static struct cached cache[DNSSLOTS];
+static int donefd = -1;
+
+static unsigned int slot(const char *host, const char *port)
+{
+	unsigned int h = 2166136261u;
+
+	for (; *host; host++)
+		h = (h ^ (unsigned char)*host) * 16777619u;
+	for (; *port; port++)
+		h = (h ^ (unsigned char)*port) * 16777619u;
+	return h % DNSSLOTS;
+}
+
+/* the answer for host:port if a live one is cached, call with lock held */
+static int cachefind(const char *host, const char *port, struct addrs *out)
+{
+	struct cached *e = &cache[slot(host, port)];
+
+	if (e->expires <= time(NULL) || strcmp(e->host, host) != 0 || strcmp(e->port, port) != 0)
+		return -1;
+	memcpy(out, &e->addrs, sizeof(struct addrs));
+	return 0;
+}
+
+/* getaddrinfo gives no TTL, so answers live DNSTTL and failures DNSNEGTTL */
+static void cachestore(const char *host, const char *port, struct addrs *a)
+{
+	struct cached *e = &cache[slot(host, port)];
+
+	strcpy(e->host, host);
+	strcpy(e->port, port);
+	memcpy(&e->addrs, a, sizeof(struct addrs));
+	e->expires = time(NULL) + ((a->n > 0) ? DNSTTL : DNSNEGTTL);
+}
+
+/* run getaddrinfo and order the answers for happy eyeballs, alternating
+   families starting with whichever getaddrinfo preferred (RFC 8305) */
+static void lookup(const char *host, const char *port, struct addrs *out)
+{
+	struct addrinfo hints, *res, *ai, *byfamily[2][MAXADDRS];
+	int count[2] = {0, 0}, first = -1;
+
+	memset(&hints, 0x0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	out->n = 0;
+	if ((out->error = getaddrinfo(host, port, &hints, &res)) != 0)
+		return;
+	for (ai = res; ai != NULL; ai = ai->ai_next)
+	{
+		int f = (ai->ai_family == AF_INET6) ? 0 : 1;
+		if (first < 0)
+			first = f;
+		if (count[f] < MAXADDRS)
+			byfamily[f][count[f]++] = ai;
+	}
+	for (int i = 0; out->n < MAXADDRS && (i < count[0] || i < count[1]); i++)
+	{
+		for (int k = 0; k < 2; k++)
+		{
+			int f = (k == 0) ? first : !first;
+			if (i < count[f] && out->n < MAXADDRS)
+			{
+				memcpy(&out->addr[out->n], byfamily[f][i]->ai_addr, byfamily[f][i]->ai_addrlen);
+				out->len[out->n++] = byfamily[f][i]->ai_addrlen;
+			}
+		}
+	}
+	freeaddrinfo(res);
+}
+
+static void *resolver(void *arg)
+{
+	uint64_t one = 1;
+
+	for (;;)
+	{
+		struct lookup *l;
+
+		pthread_mutex_lock(&lock);
+		while (todo == NULL)
+			pthread_cond_wait(&work, &lock);
+		l = todo;
+		todo = l->next;
+		if (todo == NULL)
+			todotail = NULL;
+		pthread_mutex_unlock(&lock);
+
+		lookup(l->host, l->port, &l->addrs);
+
+		pthread_mutex_lock(&lock);
+		cachestore(l->host, l->port, &l->addrs);
+		l->next = done;
+		done = l;
+		pthread_mutex_unlock(&lock);
+		if (write(donefd, &one, sizeof(one)) < 0)
+			continue;    /* the counter cannot overflow in practice */
+	}
+	return NULL;
+}
+
+/* start the resolver threads, returns an eventfd that is readable
+   whenever lookups have finished, or -1 */
+int resolverinit(int threads)
+{
+	pthread_t tid;
+
+	if (donefd >= 0)
+		return donefd;
+	if ((donefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		return -1;
+	for (int i = 0; i < threads; i++)
+	{
+		if (pthread_create(&tid, NULL, resolver, NULL) != 0)
+			return (i > 0) ? donefd : -1;
+		pthread_detach(tid);
+	}
+	return donefd;
+}
+
+/* the addresses of host:port into out if they are cached, returns 0,
+   else queues a lookup that resolvedone hands back with data, returns 1,
+   or -1 if it cannot */
+int resolve(const char *host, const char *port, void *data, struct addrs *out)
+{
+	struct lookup *l;
+
+	pthread_mutex_lock(&lock);
+	if (cachefind(host, port, out) == 0)
+	{
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (strlen(host) >= HOSTLEN || strlen(port) >= PORTLEN || (l = malloc(sizeof(struct lookup))) == NULL)
+		return -1;
+	strcpy(l->host, host);
+	strcpy(l->port, port);
+	l->data = data;
+	l->next = NULL;
+	pthread_mutex_lock(&lock);
+	if (todotail == NULL)
+		todo = l;
+	else
+		todotail->next = l;
+	todotail = l;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+	return 1;
+}
+
+/* one finished lookup, returns 0 when there are none left */
+int resolvedone(void **data, struct addrs *out)
+{
+	struct lookup *l;
+	uint64_t count;
+
+	pthread_mutex_lock(&lock);
+	if ((l = done) != NULL)
+		done = l->next;
+	pthread_mutex_unlock(&lock);
+	if (l == NULL)
+	{
+		/* reset the eventfd, a lookup finishing now just sets it again */
+		if (read(donefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			return 0;
+		pthread_mutex_lock(&lock);
+		if ((l = done) != NULL)
+			done = l->next;
+		pthread_mutex_unlock(&lock);
+		if (l == NULL)
+			return 0;
+	}
+	*data = l->data;
+	memcpy(out, &l->addrs, sizeof(struct addrs));
+	free(l);
+	return 1;
+}
+
+/* resolve host:port for a caller that has nothing else to do meanwhile,
+   returns 0 or the EAI_ error */
+int resolvewait(const char *host, const char *port, struct addrs *out)
+{
+	struct pollfd p;
+	void *data;
+
+	if (resolverinit(RESOLVERS) < 0)
+	{
+		lookup(host, port, out);
+		return out->error;
+	}
+	switch (resolve(host, port, out, out))
+	{
+	case 0:
+		return (out->n > 0) ? 0 : out->error;
+	case -1:
+		return EAI_MEMORY;
+	}
+	p.fd = donefd;
+	p.events = POLLIN;
+	for (;;)
+	{
+		while (resolvedone(&data, out))
+		{
+			if (data == out)
+				return (out->n > 0) ? 0 : out->error;
+		}
+		poll(&p, 1, -1);
+	}
+}
@@ -0,0 +1,19 @@
+#define RESOLVERS 4          /* threads running getaddrinfo */
+#define DNSSLOTS 256         /* cached answers, direct mapped */
+#define DNSTTL 60            /* seconds an answer is reused */
+#define DNSNEGTTL 5          /* seconds a failure is remembered */
+#define MAXADDRS 8
+
+/* the addresses of host:port in the order they should be tried */
+struct addrs
+{
+    int n;
+    int error;                  /* EAI_ code when n is 0 */
+    struct sockaddr_storage addr[MAXADDRS];
+    socklen_t len[MAXADDRS];
+};
+
+int resolverinit(int threads);
+int resolve(const char *host, const char *port, void *data, struct addrs *out);
+int resolvedone(void **data, struct addrs *out);
+int resolvewait(const char *host, const char *port, struct addrs *out);
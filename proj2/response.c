@@ -0,0 +1,243 @@
+// Ben Smith response.c incremental HTTP response header parsing
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "response.h"
+
+void responseinit(struct response *r)
+{
+	r->state = RSP_HEAD;
+	r->headlen = 0;
+	r->match = 0;
+	r->status = 0;
+	r->keepalive = 0;
+	r->chunked = 0;
+	r->length = -1;
+	r->received = 0;
+	r->chunkstate = CH_SIZE;
+	r->chunkleft = 0;
+	r->chunkdigits = 0;
+	r->linelen = 0;
+}
+
+/* whether the comma separated header value contains token */
+static int hastoken(const char *value, int len, const char *token)
+{
+	int toklen = strlen(token);
+
+	for (int i = 0; i + toklen <= len; i++)
+	{
+		if (strncasecmp(value + i, token, toklen) == 0 && (i == 0 || value[i - 1] == ',' || value[i - 1] == ' ') &&
+			(i + toklen == len || value[i + toklen] == ',' || value[i + toklen] == ' ' || value[i + toklen] == ';'))
+			return 1;
+	}
+	return 0;
+}
+
+/* value of header name, not NUL terminated, NULL if absent */
+const char *responseheader(struct response *r, const char *name, int *len)
+{
+	size_t namelen = strlen(name);
+	char *line = memchr(r->head, '\n', r->headlen);
+	char *end = r->head + r->headlen;
+
+	while (line != NULL && ++line < end)
+	{
+		char *eol = memchr(line, '\n', end - line);
+		if (eol == NULL)
+			break;
+		if (eol - line > namelen && line[namelen] == ':' && strncasecmp(line, name, namelen) == 0)
+		{
+			char *value = line + namelen + 1;
+			while (value < eol && (*value == ' ' || *value == '\t'))
+				value++;
+			*len = eol - value;
+			while (*len > 0 && (value[*len - 1] == '\r' || value[*len - 1] == ' '))
+				(*len)--;
+			return value;
+		}
+		line = eol;
+	}
+	return NULL;
+}
+
+/* status line and the headers framing needs, once the header is complete */
+static void parsehead(struct response *r)
+{
+	const char *value;
+	int len, minor;
+
+	r->head[r->headlen] = '\0';
+	if (r->headlen < 12 || strncmp(r->head, "HTTP/", 5) != 0 || (value = memchr(r->head, ' ', r->headlen)) == NULL)
+	{
+		r->state = RSP_ERROR;
+		return;
+	}
+	r->status = atoi(value + 1);
+	minor = (strncmp(r->head, "HTTP/1.", 7) == 0) ? r->head[7] - '0' : 0;
+	if ((value = responseheader(r, "Content-Length", &len)) != NULL)
+		r->length = strtoll(value, NULL, 10);
+	if ((value = responseheader(r, "Transfer-Encoding", &len)) != NULL && hastoken(value, len, "chunked"))
+		r->chunked = 1;
+	if ((value = responseheader(r, "Connection", &len)) != NULL)
+		r->keepalive = !hastoken(value, len, "close") && (minor >= 1 || hastoken(value, len, "keep-alive"));
+	else
+		r->keepalive = (minor >= 1);
+
+	/* these never have a body whatever the header says */
+	if (r->status / 100 == 1 || r->status == 204 || r->status == 304)
+	{
+		r->chunked = 0;
+		r->length = 0;
+	}
+	if (r->chunked)
+		r->length = -1;
+	else if (r->length == 0)
+		r->state = RSP_DONE;
+	else if (r->length < 0)
+		r->keepalive = 0;    /* the body runs to EOF */
+}
+
+/* feed bytes to the header, returns how many of them belonged to it
+   only the new bytes are scanned for the blank line, whatever follows
+   it in buf is the start of the body */
+int responsehead(struct response *r, const char *buf, int len)
+{
+	static const char crlf[] = "\r\n\r\n";
+	int i;
+
+	for (i = 0; i < len && r->state == RSP_HEAD; i++)
+	{
+		if (r->headlen == HEADMAX - 1)
+		{
+			r->state = RSP_ERROR;
+			return i;
+		}
+		r->head[r->headlen++] = buf[i];
+		/* bare LF line ends are tolerated */
+		if (buf[i] == crlf[r->match])
+			r->match++;
+		else if (buf[i] == '\n' && r->match == 1)
+			r->match = 2;
+		else
+			r->match = (buf[i] == '\r') ? 1 : 0;
+		if (r->match == 4 || (buf[i] == '\n' && r->headlen >= 2 && r->head[r->headlen - 2] == '\n'))
+		{
+			r->state = RSP_BODY;
+			parsehead(r);
+		}
+	}
+	return i;
+}
+
+/* take body bytes from the front of buf, returns how many were consumed
+   and points data at the body bytes among them, which chunked framing
+   may leave empty; anything past the end of the body is left in buf */
+int responsebody(struct response *r, const char *buf, int len, const char **data, int *datalen)
+{
+	int i;
+
+	*data = buf;
+	*datalen = 0;
+	if (!r->chunked)
+	{
+		if (r->length >= 0 && len > r->length - r->received)
+			len = r->length - r->received;
+		r->received += len;
+		*datalen = len;
+		if (r->received == r->length)
+			r->state = RSP_DONE;
+		return len;
+	}
+
+	if (r->chunkstate == CH_DATA)
+	{
+		if (len > r->chunkleft)
+			len = r->chunkleft;
+		r->chunkleft -= len;
+		r->received += len;
+		*datalen = len;
+		if (r->chunkleft == 0)
+			r->chunkstate = CH_DATAEND;
+		return len;
+	}
+
+	/* framing lines are consumed a byte at a time up to the next data */
+	for (i = 0; i < len && r->state == RSP_BODY && r->chunkstate != CH_DATA; i++)
+	{
+		char ch = buf[i];
+		switch (r->chunkstate)
+		{
+		case CH_SIZE:
+			if (ch == '\n')
+			{
+				if (r->chunkdigits == 0)
+					r->state = RSP_ERROR;
+				else if (r->chunkleft == 0)
+					r->chunkstate = CH_TRAILER;
+				else
+					r->chunkstate = CH_DATA;
+				r->chunkdigits = 0;
+			}
+			else if (r->chunkdigits >= 0 && ((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F')))
+			{
+				if (++r->chunkdigits > 15)
+					r->state = RSP_ERROR;
+				r->chunkleft = r->chunkleft * 16 + ((ch <= '9') ? ch - '0' : (ch | 0x20) - 'a' + 10);
+			}
+			else if (r->chunkdigits > 0)
+				r->chunkdigits = -r->chunkdigits;    /* extensions, skip to the line end */
+			else if (r->chunkdigits == 0 && ch != ' ')
+				r->state = RSP_ERROR;
+			break;
+		case CH_DATAEND:
+			if (ch == '\n')
+				r->chunkstate = CH_SIZE;
+			else if (ch != '\r')
+				r->state = RSP_ERROR;
+			break;
+		case CH_TRAILER:
+			if (ch == '\n')
+			{
+				if (r->linelen == 0)
+					r->state = RSP_DONE;
+				r->linelen = 0;
+			}
+			else if (ch != '\r')
+				r->linelen++;
+			break;
+		}
+	}
+	return i;
+}
+
+/* the connection closed, returns 0 if that completed the body */
+int responseend(struct response *r)
+{
+	if (r->state == RSP_BODY && !r->chunked && r->length < 0)
+		r->state = RSP_DONE;
+	return (r->state == RSP_DONE) ? 0 : -1;
+}
+
+/* first byte of a Content-Range, -1 if there is none, with the complete
+   length in *total (-1 if unknown) when total is not NULL */
+long long responserange(struct response *r, long long *total)
+{
+	const char *value, *slash;
+	char *end;
+	long long start;
+	int len;
+
+	if ((value = responseheader(r, "Content-Range", &len)) == NULL || len < 6 || strncasecmp(value, "bytes ", 6) != 0)
+		return -1;
+	start = strtoll(value + 6, &end, 10);
+	if (end == value + 6)
+		start = -1;    /* bytes * / length */
+	if (total != NULL)
+	{
+		slash = memchr(value, '/', len);
+		*total = (slash != NULL && slash[1] != '*') ? strtoll(slash + 1, NULL, 10) : -1;
+	}
+	return start;
+}
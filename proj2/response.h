@@ -0,0 +1,35 @@
+#define HEADMAX 16384        /* largest response header accepted */
+#define RSP_HEAD 0           /* still collecting the header */
+#define RSP_BODY 1           /* header complete, bytes now belong to the body */
+#define RSP_DONE 2           /* body complete, anything after is the next response */
+#define RSP_ERROR 3          /* header too big, not HTTP or bad chunking */
+
+#define CH_SIZE 0            /* chunk size line */
+#define CH_DATA 1
+#define CH_DATAEND 2         /* CRLF after the data */
+#define CH_TRAILER 3         /* trailer lines after the last chunk */
+
+/* an HTTP response read incrementally, the header is kept for lookups */
+struct response
+{
+    int state;
+    char head[HEADMAX];
+    unsigned int headlen;
+    unsigned int match;         /* how much of CRLF CRLF the last bytes matched */
+    int status;
+    int keepalive;              /* connection may carry another response */
+    int chunked;
+    long long length;           /* Content-Length, -1 if absent */
+    long long received;         /* body bytes seen so far */
+    int chunkstate;
+    long long chunkleft;        /* size being parsed, then data still to come */
+    int chunkdigits;
+    int linelen;                /* bytes on the current trailer line */
+};
+
+void responseinit(struct response *r);
+int responsehead(struct response *r, const char *buf, int len);
+int responsebody(struct response *r, const char *buf, int len, const char **data, int *datalen);
+int responseend(struct response *r);
+long long responserange(struct response *r, long long *total);
+const char *responseheader(struct response *r, const char *name, int *len);
@@ -0,0 +1,94 @@
+// Ben Smith timing.c per-phase fetch timing and repeat statistics
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "timing.h"
+
+static char *names[NPHASES] = {"dns", "connect", "ttfb", "header", "body", "total"};
+static double marks[NPHASES];   /* the start, then the end of each phase */
+
+double monotonic()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void timingstart()
+{
+	for (int i = 0; i < NPHASES; i++)
+		marks[i] = 0;
+	marks[0] = monotonic();
+}
+
+/* phase just ended, the next one starts now */
+void mark(int phase)
+{
+	marks[phase + 1] = monotonic();
+}
+
+/* a phase that never happened takes no time */
+void timingresult(struct timing *t, long long bytes)
+{
+	double last = marks[0];
+
+	for (int i = 0; i < PH_TOTAL; i++)
+	{
+		if (marks[i + 1] < last)
+			marks[i + 1] = last;
+		t->phase[i] = marks[i + 1] - last;
+		last = marks[i + 1];
+	}
+	t->phase[PH_TOTAL] = last - marks[0];
+	t->bytes = bytes;
+}
+
+static double rate(struct timing *t)
+{
+	return (t->phase[PH_TOTAL] > 0) ? t->bytes / t->phase[PH_TOTAL] / 1e6 : 0;
+}
+
+void printtiming(struct timing *t)
+{
+	printf("TIME:");
+	for (int i = 0; i < NPHASES; i++)
+		printf(" %s %.3f ms", names[i], t->phase[i] * 1e3);
+	printf(" bytes %lld rate %.1f MB/s\n", t->bytes, rate(t));
+}
+
+static int compare(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* nearest rank, so p99 of fewer than 100 runs is the slowest */
+static double rank(double *sorted, int n, double p)
+{
+	int i = (int)(p * n + 0.999999) - 1;
+
+	return sorted[(i < 0) ? 0 : i];
+}
+
+/* min, median and p99 of every phase and of throughput across n runs */
+void printtimings(struct timing *runs, int n)
+{
+	double *v = malloc(n * sizeof(double));
+
+	if (v == NULL)
+		return;
+	printf("TIME: runs %d\n", n);
+	printf("TIME: %-8s %10s %10s %10s\n", "phase", "min", "median", "p99");
+	for (int i = 0; i <= NPHASES; i++)
+	{
+		for (int r = 0; r < n; r++)
+			v[r] = (i < NPHASES) ? runs[r].phase[i] * 1e3 : rate(&runs[r]);
+		qsort(v, n, sizeof(double), compare);
+		printf("TIME: %-8s %10.3f %10.3f %10.3f %s\n", (i < NPHASES) ? names[i] : "rate", v[0], rank(v, n, 0.5), rank(v, n, 0.99),
+			(i < NPHASES) ? "ms" : "MB/s");
+	}
+	free(v);
+}
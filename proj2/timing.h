@@ -0,0 +1,21 @@
+#define PH_DNS 0             /* name resolution */
+#define PH_CONNECT 1         /* TCP connect */
+#define PH_TTFB 2            /* request sent until the first response byte */
+#define PH_HEADER 3          /* first byte until the header is complete */
+#define PH_BODY 4            /* the body transfer */
+#define PH_TOTAL 5
+#define NPHASES 6
+
+/* how long each phase of one fetch took, in seconds */
+struct timing
+{
+    double phase[NPHASES];
+    long long bytes;
+};
+
+double monotonic();
+void timingstart();
+void mark(int phase);
+void timingresult(struct timing *t, long long bytes);
+void printtiming(struct timing *t);
+void printtimings(struct timing *runs, int n);
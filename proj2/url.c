@@ -0,0 +1,52 @@
+// Ben Smith url.c split http://host[:port][/path] URLs
+
+#include <string.h>
+#include <strings.h>
+#include "url.h"
+
+#define SCHEME "http://"
+
+/* fill u from s, returns 0 or -1 if s is not an http URL we can fetch */
+int parseurl(const char *s, struct url *u)
+{
+	const char *host, *end, *colon;
+	size_t hostlen, portlen;
+
+	if (strncasecmp(s, SCHEME, strlen(SCHEME)) != 0)
+		return -1;
+	host = s + strlen(SCHEME);
+	end = host + strcspn(host, "/?#");
+	u->path = (*end == '/') ? end : "/";
+
+	/* [v6 literal] or name, then an optional :port */
+	if (*host == '[')
+	{
+		const char *close = memchr(host, ']', end - host);
+		if (close == NULL)
+			return -1;
+		hostlen = close - host - 1;
+		host++;
+		colon = (close + 1 < end && close[1] == ':') ? close + 1 : NULL;
+	}
+	else
+	{
+		colon = memchr(host, ':', end - host);
+		hostlen = ((colon != NULL) ? colon : end) - host;
+	}
+	if (hostlen == 0 || hostlen >= HOSTLEN)
+		return -1;
+	memcpy(u->host, host, hostlen);
+	u->host[hostlen] = '\0';
+
+	if (colon == NULL)
+		strcpy(u->port, DEFPORT);
+	else
+	{
+		portlen = end - colon - 1;
+		if (portlen == 0 || portlen >= PORTLEN || strspn(colon + 1, "0123456789") < portlen)
+			return -1;
+		memcpy(u->port, colon + 1, portlen);
+		u->port[portlen] = '\0';
+	}
+	return 0;
+}
@@ -0,0 +1,13 @@
+#define HOSTLEN 256
+#define PORTLEN 8
+#define DEFPORT "80"
+
+/* the parts of an http:// URL, host without brackets for IPv6 literals */
+struct url
+{
+    char host[HOSTLEN];
+    char port[PORTLEN];
+    const char *path;           /* points into the parsed string, "/" if it had none */
+};
+
+int parseurl(const char *s, struct url *u);
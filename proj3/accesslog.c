@@ -0,0 +1,183 @@
+// Ben Smith accesslog.c batched access log fed by per-thread rings
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include "accesslog.h"
+
+/* single producer (a worker) single consumer (the writer) ring,
+   head and tail live on their own cache lines */
+struct logring
+{
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long tail __attribute__((aligned(64)));
+	struct logrec recs[LOGRING];
+};
+
+static struct logring *rings = NULL;
+static int nrings = 0;
+static char *logpath = NULL;
+static off_t rotatesize = 0;
+static off_t written = 0;
+static int logfd = -1;
+static volatile int stopping = 0;
+static volatile int reopen = 0;
+static pthread_t writer;
+static char batch[LOGBATCH];
+static size_t batchlen = 0;
+
+static int openlog()
+{
+	if ((logfd = open(logpath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+		return -1;
+	written = lseek(logfd, 0, SEEK_END);
+	return 0;
+}
+
+static void flushbatch()
+{
+	size_t off = 0;
+	ssize_t bytes;
+
+	while (off < batchlen)
+	{
+		bytes = write(logfd, batch + off, batchlen - off);
+		if (bytes <= 0)
+			break;
+		off += bytes;
+	}
+	written += batchlen;
+	batchlen = 0;
+
+	/* size based rotation keeps one old file next to the live one */
+	if (rotatesize > 0 && written >= rotatesize)
+	{
+		char old[4096];
+		snprintf(old, sizeof(old), "%s.1", logpath);
+		rename(logpath, old);
+		reopen = 1;
+	}
+	if (reopen)
+	{
+		/* rotated away by us or by logrotate + SIGHUP */
+		reopen = 0;
+		close(logfd);
+		openlog();
+	}
+}
+
+/* the date only changes once a second, so only format it that often */
+static char *logdate(time_t secs)
+{
+	static time_t last = -1;
+	static char date[64];
+	struct tm tm;
+
+	if (secs != last)
+	{
+		gmtime_r(&secs, &tm);
+		strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+		last = secs;
+	}
+	return date;
+}
+
+static void format(struct logrec *r)
+{
+	char addr[INET6_ADDRSTRLEN];
+
+	if (batchlen + LOGLINE + 256 > LOGBATCH)
+		flushbatch();
+	if (IN6_IS_ADDR_V4MAPPED(&r->addr))
+		inet_ntop(AF_INET, &r->addr.s6_addr[12], addr, sizeof(addr));
+	else
+		inet_ntop(AF_INET6, &r->addr, addr, sizeof(addr));
+	batchlen += snprintf(batch + batchlen, LOGBATCH - batchlen, "%s - - [%s] \"%.*s\" %u %llu %lluus\n",
+						 addr, logdate(r->when.tv_sec), r->linelen, r->line, r->status, r->bytes, r->usecs);
+}
+
+static int drain()
+{
+	int n = 0;
+
+	for (int i = 0; i < nrings; i++)
+	{
+		struct logring *ring = &rings[i];
+		unsigned long tail = ring->tail;
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		for (; tail != head; tail++, n++)
+			format(&ring->recs[tail & (LOGRING - 1)]);
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	return n;
+}
+
+static void *writeloop(void *arg)
+{
+	struct timespec pause = {0, LOGFLUSH * 1000000L};
+
+	while (!stopping)
+	{
+		/* keep going while there is a backlog, otherwise nap */
+		if (drain() == 0)
+			nanosleep(&pause, NULL);
+		if (batchlen > 0 || reopen)
+			flushbatch();
+	}
+	drain();
+	flushbatch();
+	return NULL;
+}
+
+/* open path and start the writer for nthreads producers */
+int loginit(char *path, off_t size, int nthreads)
+{
+	logpath = path;
+	rotatesize = size;
+	if (openlog() < 0)
+		return -1;
+	if (posix_memalign((void **)&rings, 64, nthreads * sizeof(struct logring)) != 0)
+		return -1;
+	memset(rings, 0x0, nthreads * sizeof(struct logring));
+	nrings = nthreads;
+	if (pthread_create(&writer, NULL, writeloop, NULL) != 0)
+		return -1;
+	return 0;
+}
+
+/* called by the serving thread, never blocks; returns -1 when the ring is full
+   and the record was dropped */
+int logpush(int thread, struct logrec *r)
+{
+	struct logring *ring = &rings[thread];
+	unsigned long head = ring->head;
+
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOGRING)
+		return -1;
+	memcpy(&ring->recs[head & (LOGRING - 1)], r, sizeof(struct logrec));
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* safe from a signal handler, the writer reopens the file on its next pass */
+void logreopen()
+{
+	reopen = 1;
+}
+
+/* write out everything still queued and stop the writer */
+void logstop()
+{
+	if (rings == NULL)
+		return;
+	stopping = 1;
+	pthread_join(writer, NULL);
+	close(logfd);
+}
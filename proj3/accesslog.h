@@ -0,0 +1,21 @@
+#define LOGRING 4096             /* records per thread, power of two */
+#define LOGLINE 200              /* request line bytes kept per record */
+#define LOGBATCH (256 << 10)     /* formatted bytes written per write() */
+#define LOGFLUSH 100             /* ms between writer passes */
+
+/* one request, fixed size so the serving thread only copies it into its ring */
+struct logrec
+{
+    struct timespec when;
+    struct in6_addr addr;       /* client, an IPv4 one v4-mapped */
+    unsigned short status;
+    unsigned short linelen;
+    unsigned long long bytes;
+    unsigned long long usecs;
+    char line[LOGLINE];         /* method, target and version, not terminated */
+};
+
+int loginit(char *path, off_t rotatesize, int nthreads);
+int logpush(int thread, struct logrec *r);
+void logreopen();
+void logstop();
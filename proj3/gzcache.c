@@ -0,0 +1,288 @@
+// Ben Smith gzcache.c bounded LRU cache of gzip-compressed files
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "gzcache.h"
+
+static struct gzentry *buckets[GZBUCKETS];
+static struct gzentry *lruhead = NULL;
+static struct gzentry *lrutail = NULL;
+static size_t cachelimit = GZCACHEMAX;
+static size_t cachebytes = 0;
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueready = PTHREAD_COND_INITIALIZER;
+static struct gzentry *queuehead = NULL;
+static struct gzentry *queuetail = NULL;
+static int queued = 0;
+
+static void *compressor(void *arg);
+
+/* start the compressor, without it nothing is compressed */
+void gzinit(size_t limit)
+{
+	pthread_t thread;
+
+	cachelimit = limit;
+	if (limit > 0 && pthread_create(&thread, NULL, compressor, NULL) != 0)
+		cachelimit = 0;
+	else if (limit > 0)
+		pthread_detach(thread);
+}
+
+static unsigned int gzhash(dev_t dev, ino_t ino)
+{
+	return (unsigned int)((ino * 0x9e3779b97f4a7c15ULL) ^ dev) % GZBUCKETS;
+}
+
+static size_t entrycost(struct gzentry *e)
+{
+	return sizeof(struct gzentry) + e->len;
+}
+
+static void lruunlink(struct gzentry *e)
+{
+	if (e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		lruhead = e->next;
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		lrutail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void lrupush(struct gzentry *e)
+{
+	e->prev = NULL;
+	e->next = lruhead;
+	if (lruhead != NULL)
+		lruhead->prev = e;
+	lruhead = e;
+	if (lrutail == NULL)
+		lrutail = e;
+}
+
+static void unref(struct gzentry *e)
+{
+	if (--e->refs == 0)
+	{
+		free(e->data);
+		free(e);
+	}
+}
+
+/* drop the entry from the cache, requests still sending it keep it alive */
+static void evict(struct gzentry *e)
+{
+	struct gzentry **link = &buckets[gzhash(e->dev, e->ino)];
+
+	while (*link != e)
+		link = &(*link)->hnext;
+	*link = e->hnext;
+	lruunlink(e);
+	cachebytes -= entrycost(e);
+	unref(e);
+}
+
+/* whether e is still the cached entry for its file; needs cachelock */
+static int incache(struct gzentry *e)
+{
+	struct gzentry *c;
+
+	for (c = buckets[gzhash(e->dev, e->ino)]; c != NULL && c != e; c = c->hnext)
+		;
+	return c != NULL;
+}
+
+/* make room and add e; needs cachelock */
+static void insert(struct gzentry *e)
+{
+	unsigned int bucket = gzhash(e->dev, e->ino);
+
+	while (lrutail != NULL && cachebytes + entrycost(e) > cachelimit)
+		evict(lrutail);
+	e->hnext = buckets[bucket];
+	buckets[bucket] = e;
+	lrupush(e);
+	cachebytes += entrycost(e);
+}
+
+/* cached entry for this version of the file, evicting a stale one; needs cachelock */
+static struct gzentry *find(struct stat *st)
+{
+	struct gzentry *e;
+
+	for (e = buckets[gzhash(st->st_dev, st->st_ino)]; e != NULL; e = e->hnext)
+	{
+		if (e->dev == st->st_dev && e->ino == st->st_ino)
+			break;
+	}
+	if (e == NULL)
+		return NULL;
+	if (e->size == st->st_size && e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec)
+		return e;
+	/* file changed since it was compressed */
+	evict(e);
+	return NULL;
+}
+
+/* gzip the whole file into a fresh buffer, returns NULL if it does not shrink */
+static char *compressfile(int fd, off_t size, size_t *len)
+{
+	char *in, *out;
+	z_stream zs;
+	ssize_t bytes;
+	off_t got = 0;
+
+	if ((in = malloc(size)) == NULL)
+		return NULL;
+	while (got < size)
+	{
+		bytes = pread(fd, in + got, size - got, got);
+		if (bytes <= 0)
+		{
+			free(in);
+			return NULL;
+		}
+		got += bytes;
+	}
+
+	memset(&zs, 0x0, sizeof(zs));
+	/* 15 window bits + 16 asks zlib for a gzip wrapper */
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		free(in);
+		return NULL;
+	}
+	*len = deflateBound(&zs, size);
+	if ((out = malloc(*len)) == NULL)
+	{
+		deflateEnd(&zs);
+		free(in);
+		return NULL;
+	}
+	zs.next_in = (unsigned char *)in;
+	zs.avail_in = size;
+	zs.next_out = (unsigned char *)out;
+	zs.avail_out = *len;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out >= (unsigned long)size)
+	{
+		deflateEnd(&zs);
+		free(in);
+		free(out);
+		return NULL;
+	}
+	*len = zs.total_out;
+	deflateEnd(&zs);
+	free(in);
+	return out;
+}
+
+/* compress queued files one at a time, off the event loops, filling in
+   their entries unless they were evicted or went stale meanwhile */
+static void *compressor(void *arg)
+{
+	struct gzentry *e;
+	char *data;
+	size_t len;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&cachelock);
+		while (queuehead == NULL)
+			pthread_cond_wait(&queueready, &cachelock);
+		e = queuehead;
+		if ((queuehead = e->qnext) == NULL)
+			queuetail = NULL;
+		queued--;
+		pthread_mutex_unlock(&cachelock);
+
+		data = compressfile(e->fd, e->size, &len);
+		close(e->fd);
+
+		pthread_mutex_lock(&cachelock);
+		if (incache(e))
+		{
+			cachebytes -= entrycost(e);
+			e->data = data;
+			e->len = (data != NULL) ? len : 0;
+			e->pending = 0;
+			cachebytes += entrycost(e);
+			while (lrutail != NULL && cachebytes > cachelimit)
+				evict(lrutail);
+		}
+		else
+			free(data);
+		unref(e);
+		pthread_mutex_unlock(&cachelock);
+	}
+	return NULL;
+}
+
+/* cached gzip encoding of the open file fd
+   returns NULL if the file is not cacheable or not compressed yet, the first
+   request queues it for the compressor and goes out as it is, so no event
+   loop waits on compression and a file is only compressed once; an entry
+   with data NULL means compressing it does not pay off; entries must be
+   handed back with gzrelease */
+struct gzentry *gzlookup(int fd, struct stat *st)
+{
+	struct gzentry *e;
+
+	if (cachelimit == 0 || st->st_size < GZMINFILE || (size_t)st->st_size > cachelimit / 4)
+		return NULL;
+
+	pthread_mutex_lock(&cachelock);
+	if ((e = find(st)) != NULL)
+	{
+		lruunlink(e);
+		lrupush(e);
+		if (e->pending)
+			e = NULL;
+		else
+			e->refs++;
+		pthread_mutex_unlock(&cachelock);
+		return e;
+	}
+
+	/* the compressor keeps its own descriptor, the request's may be closed first */
+	if (queued < GZQUEUEMAX && (e = calloc(1, sizeof(struct gzentry))) != NULL)
+	{
+		if ((e->fd = dup(fd)) < 0)
+			free(e);
+		else
+		{
+			e->dev = st->st_dev;
+			e->ino = st->st_ino;
+			e->size = st->st_size;
+			e->mtime = st->st_mtim;
+			e->pending = 1;
+			/* the cache's reference and the compressor's */
+			e->refs = 2;
+			insert(e);
+			if (queuetail != NULL)
+				queuetail->qnext = e;
+			else
+				queuehead = e;
+			queuetail = e;
+			queued++;
+			pthread_cond_signal(&queueready);
+		}
+	}
+	pthread_mutex_unlock(&cachelock);
+	return NULL;
+}
+
+void gzrelease(struct gzentry *e)
+{
+	pthread_mutex_lock(&cachelock);
+	unref(e);
+	pthread_mutex_unlock(&cachelock);
+}
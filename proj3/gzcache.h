@@ -0,0 +1,26 @@
+#define GZBUCKETS 1024
+#define GZMINFILE 256            /* not worth compressing below this */
+#define GZCACHEMAX (32 << 20)    /* default bytes of compressed data kept */
+#define GZQUEUEMAX 64            /* files waiting for the compressor, later ones wait for a later request */
+
+/* gzip encoding of one version of a file, keyed by inode, size and mtime */
+struct gzentry
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    char *data;                 /* NULL when compression did not help */
+    size_t len;
+    int pending;                /* still being compressed, from fd */
+    int fd;
+    struct gzentry *qnext;      /* compressor queue */
+    struct gzentry *prev;       /* LRU list, head is most recently used */
+    struct gzentry *next;
+    struct gzentry *hnext;      /* hash chain */
+    int refs;                   /* cache's own reference plus requests sending it */
+};
+
+void gzinit(size_t limit);
+struct gzentry *gzlookup(int fd, struct stat *st);
+void gzrelease(struct gzentry *e);
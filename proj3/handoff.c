@@ -0,0 +1,133 @@
+// Ben Smith handoff.c pass the listening socket between server processes
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "handoff.h"
+
+static int unixaddr(char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0x0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return -1;
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+/* control socket a replacement server connects to, only our user may use it */
+int handofflisten(char *path)
+{
+	struct sockaddr_un addr;
+	mode_t old;
+	int ctl;
+
+	if (unixaddr(path, &addr) < 0)
+		return -1;
+	if ((ctl = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	/* a path left behind by a server that died is stale */
+	unlink(path);
+	old = umask(0077);
+	if (bind(ctl, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(ctl, 1) < 0)
+	{
+		umask(old);
+		close(ctl);
+		return -1;
+	}
+	umask(old);
+	return ctl;
+}
+
+/* accept the replacement on ctl and pass it sd with SCM_RIGHTS
+   the connection to it is left in *peer for the rest of the handshake */
+int handoffsend(int ctl, int sd, int *peer)
+{
+	char cmsgbuf[CMSG_SPACE(sizeof(int))];
+	char tag = 'L';
+	struct iovec iov = {&tag, 1};
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	if ((*peer = accept(ctl, NULL, NULL)) < 0)
+		return -1;
+
+	memset(&msg, 0x0, sizeof(msg));
+	memset(cmsgbuf, 0x0, sizeof(cmsgbuf));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &sd, sizeof(int));
+
+	if (sendmsg(*peer, &msg, 0) < 0)
+	{
+		close(*peer);
+		return -1;
+	}
+	return 0;
+}
+
+/* connect to the running server at path and receive its listening socket */
+int handoffreceive(char *path, int *peer)
+{
+	char cmsgbuf[CMSG_SPACE(sizeof(int))];
+	char tag;
+	struct iovec iov = {&tag, 1};
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int sd;
+
+	if (unixaddr(path, &addr) < 0)
+		return -1;
+	if ((*peer = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	if (connect(*peer, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		close(*peer);
+		return -1;
+	}
+
+	memset(&msg, 0x0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+	if (recvmsg(*peer, &msg, MSG_CMSG_CLOEXEC) <= 0 || (cmsg = CMSG_FIRSTHDR(&msg)) == NULL ||
+		cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+	{
+		close(*peer);
+		return -1;
+	}
+	memcpy(&sd, CMSG_DATA(cmsg), sizeof(int));
+	return sd;
+}
+
+int handoffsignal(int peer, char msg)
+{
+	return (write(peer, &msg, 1) == 1) ? 0 : -1;
+}
+
+/* wait up to timeout ms (-1 forever) for msg from the other server */
+int handoffwait(int peer, char msg, int timeout)
+{
+	struct pollfd pfd = {peer, POLLIN, 0};
+	char got;
+	int n;
+
+	while ((n = poll(&pfd, 1, timeout)) < 0 && errno == EINTR)
+		;
+	if (n <= 0)
+		return -1;
+	return (read(peer, &got, 1) == 1 && got == msg) ? 0 : -1;
+}
@@ -0,0 +1,9 @@
+#define HANDOFF_READY 'R'    /* new server is accepting on the socket */
+#define HANDOFF_DONE 'D'     /* old server stopped accepting and released the path */
+#define HANDOFF_WAIT 10000   /* ms the old server waits for HANDOFF_READY */
+
+int handofflisten(char *path);
+int handoffsend(int ctl, int sd, int *peer);
+int handoffreceive(char *path, int *peer);
+int handoffsignal(int peer, char msg);
+int handoffwait(int peer, char msg, int timeout);
@@ -0,0 +1,219 @@
+// Ben Smith httpparse.c incremental HTTP request header parser
+
+#include <string.h>
+#include <strings.h>
+#include "httpparse.h"
+
+#define ST_LEAD 0    /* spaces before method */
+#define ST_METHOD 1
+#define ST_SP1 2
+#define ST_TARGET 3
+#define ST_SP2 4
+#define ST_VERSION 5
+#define ST_REQCR 6   /* CR seen at end of request line */
+#define ST_LINE 7    /* start of a header line */
+#define ST_NAME 8
+#define ST_VALUE 9
+#define ST_HCR 10    /* CR seen inside a header line */
+#define ST_ENDCR 11  /* CR seen at the start of a line */
+#define ST_DONE 12
+#define ST_ERROR 13
+
+void parserinit(struct httpparser *p, unsigned int limit)
+{
+	memset(p, 0x0, sizeof(struct httpparser));
+	p->state = ST_LEAD;
+	p->limit = limit;
+}
+
+/* close out the header line ending at the CR before p->pos */
+static void endheader(struct httpparser *p, const char *buf)
+{
+	unsigned int end = p->pos - 1;
+	struct header *h;
+
+	if (p->nheaders >= HDRMAX)
+		return;
+	h = &p->headers[p->nheaders++];
+	h->name.off = p->linestart;
+	if (p->valstart == 0)
+	{
+		h->name.len = end - p->linestart;
+		h->value.off = end;
+		h->value.len = 0;
+		return;
+	}
+	h->name.len = p->nameend - p->linestart;
+	while (h->name.len > 0 && buf[h->name.off + h->name.len - 1] == ' ')
+		h->name.len--;
+	h->value.off = p->valstart;
+	h->value.len = (end > p->valstart) ? end - p->valstart : 0;
+	while (h->value.len > 0 && (buf[h->value.off + h->value.len - 1] == ' ' || buf[h->value.off + h->value.len - 1] == '\t'))
+		h->value.len--;
+}
+
+/* buf holds len bytes received so far on the connection, always starting at
+   the request; parsing picks up where the previous call stopped
+   rules follow the original validator:
+   METHOD SP+ TARGET SP+ VERSION CRLF, every header line ends in CRLF,
+   header ends with an empty line */
+int parserequest(struct httpparser *p, const char *buf, unsigned int len)
+{
+	if (p->state == ST_DONE)
+		return PARSE_DONE;
+
+	while (p->pos < len)
+	{
+		char c = buf[p->pos];
+
+		if (p->pos >= p->limit)
+			return PARSE_TOOBIG;
+
+		switch (p->state)
+		{
+		case ST_LEAD:
+			if (c == '\r' || c == '\n')
+				p->state = ST_ERROR;
+			else if (c != ' ')
+			{
+				p->method.off = p->pos;
+				p->state = ST_METHOD;
+			}
+			break;
+		case ST_METHOD:
+			if (c == '\r' || c == '\n')
+				p->state = ST_ERROR;
+			else if (c == ' ')
+			{
+				p->method.len = p->pos - p->method.off;
+				p->state = ST_SP1;
+			}
+			break;
+		case ST_SP1:
+			if (c == '\r' || c == '\n')
+				p->state = ST_ERROR;
+			else if (c != ' ')
+			{
+				p->target.off = p->pos;
+				p->state = ST_TARGET;
+			}
+			break;
+		case ST_TARGET:
+			if (c == '\r' || c == '\n')
+				p->state = ST_ERROR;
+			else if (c == ' ')
+			{
+				p->target.len = p->pos - p->target.off;
+				p->state = ST_SP2;
+			}
+			break;
+		case ST_SP2:
+			if (c == '\r' || c == '\n')
+				p->state = ST_ERROR;
+			else if (c != ' ')
+			{
+				p->version.off = p->pos;
+				p->state = ST_VERSION;
+			}
+			break;
+		case ST_VERSION:
+			/* anything after the version besides CRLF is malformed */
+			if (c == ' ' || c == '\n')
+				p->state = ST_ERROR;
+			else if (c == '\r')
+			{
+				p->version.len = p->pos - p->version.off;
+				p->state = ST_REQCR;
+			}
+			break;
+		case ST_REQCR:
+			p->state = (c == '\n') ? ST_LINE : ST_ERROR;
+			break;
+		case ST_LINE:
+			p->linestart = p->pos;
+			p->valstart = 0;
+			if (c == '\r')
+				p->state = ST_ENDCR;
+			else if (c == '\n')
+				p->state = ST_ERROR;
+			else
+				p->state = (c == ':') ? ST_VALUE : ST_NAME;
+			if (c == ':')
+			{
+				p->nameend = p->pos;
+				p->valstart = p->pos + 1;
+			}
+			break;
+		case ST_NAME:
+			if (c == ':')
+			{
+				p->nameend = p->pos;
+				p->valstart = p->pos + 1;
+				p->state = ST_VALUE;
+			}
+			else if (c == '\r')
+				p->state = ST_HCR;
+			else if (c == '\n')
+				p->state = ST_ERROR;
+			break;
+		case ST_VALUE:
+			if ((c == ' ' || c == '\t') && p->pos == p->valstart)
+				p->valstart++;
+			else if (c == '\r')
+				p->state = ST_HCR;
+			else if (c == '\n')
+				p->state = ST_ERROR;
+			break;
+		case ST_HCR:
+			/* a lone CR is just part of the line */
+			if (c == '\n')
+			{
+				endheader(p, buf);
+				p->state = ST_LINE;
+			}
+			else if (c != '\r')
+				p->state = (p->valstart == 0) ? ST_NAME : ST_VALUE;
+			break;
+		case ST_ENDCR:
+			if (c == '\n')
+			{
+				p->state = ST_DONE;
+				p->headerlen = p->pos + 1;
+				return PARSE_DONE;
+			}
+			else if (c != '\r')
+				p->state = ST_NAME;
+			break;
+		}
+
+		if (p->state == ST_ERROR)
+			return PARSE_ERROR;
+		p->pos++;
+	}
+
+	if (p->state == ST_DONE)
+		return PARSE_DONE;
+	if (p->pos >= p->limit)
+		return PARSE_TOOBIG;
+	return PARSE_MORE;
+}
+
+int spaneq(const char *buf, struct span s, const char *str)
+{
+	return (strlen(str) == s.len && strncmp(buf + s.off, str, s.len) == 0);
+}
+
+int spancaseeq(const char *buf, struct span s, const char *str)
+{
+	return (strlen(str) == s.len && strncasecmp(buf + s.off, str, s.len) == 0);
+}
+
+struct header *findheader(struct httpparser *p, const char *buf, const char *name)
+{
+	for (int i = 0; i < p->nheaders; i++)
+	{
+		if (spancaseeq(buf, p->headers[i].name, name))
+			return &p->headers[i];
+	}
+	return NULL;
+}
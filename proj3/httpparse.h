@@ -0,0 +1,42 @@
+#define HDRMAX 32            /* header lines recorded per request */
+#define PARSE_MORE 0         /* need more bytes */
+#define PARSE_DONE 1         /* full header seen, spans are valid */
+#define PARSE_ERROR 2        /* malformed request, answer 400 */
+#define PARSE_TOOBIG 3       /* header exceeded limit, answer 400 */
+
+/* region of the connection buffer, nothing is copied out */
+struct span
+{
+    unsigned int off;
+    unsigned int len;
+};
+
+/* one header line, value is empty for lines without a ':' */
+struct header
+{
+    struct span name;
+    struct span value;
+};
+
+/* resumable request header parser, feed it the same buffer as it grows */
+struct httpparser
+{
+    int state;
+    unsigned int pos;           /* next byte to examine */
+    unsigned int linestart;     /* start of the current header line */
+    unsigned int nameend;       /* position of its ':' */
+    unsigned int valstart;      /* start of its value, 0 before the ':' */
+    unsigned int limit;         /* max bytes allowed for the header */
+    unsigned int headerlen;     /* bytes up to and including final CRLF CRLF */
+    struct span method;
+    struct span target;
+    struct span version;
+    struct header headers[HDRMAX];
+    int nheaders;
+};
+
+void parserinit(struct httpparser *p, unsigned int limit);
+int parserequest(struct httpparser *p, const char *buf, unsigned int len);
+int spaneq(const char *buf, struct span s, const char *str);
+int spancaseeq(const char *buf, struct span s, const char *str);
+struct header *findheader(struct httpparser *p, const char *buf, const char *name);
@@ -0,0 +1,572 @@
+// Ben Smith loadgen.c HTTP load generator for proj3
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+
+#define SUCCESS 0
+#define ERROR 1
+#define PROTOCOL "tcp"
+#define BUFLEN 65536
+#define REQLEN 1024
+#define URLMAX 1024
+#define PIPEMAX 64
+#define HEAD_END "\r\n\r\n"
+
+/* log-linear latency histogram in microseconds, HDR style:
+   128 linear sub-buckets, then 64 per power of two (under 1% error) */
+#define SUBBITS 7
+#define SUBCOUNT (1 << SUBBITS)
+#define HALFCOUNT (SUBCOUNT / 2)
+#define MAXSHIFT 34
+#define HISTLEN ((MAXSHIFT + 2) * HALFCOUNT)
+
+#define CL_CLOSED 0
+#define CL_CONNECTING 1
+#define CL_ACTIVE 2
+
+struct client
+{
+	int sd;
+	int state;
+	int onconn;                 /* requests issued on this connection */
+	long long connstart;
+	long long sent[PIPEMAX];    /* issue times of outstanding requests, oldest first */
+	int head, count;
+	char out[REQLEN * PIPEMAX]; /* request bytes not yet written */
+	size_t outlen, outoff;
+	char in[BUFLEN];            /* response bytes not yet consumed */
+	size_t inlen;
+	int inheader;
+	int status;
+	int closeafter;
+	long long bodyleft;         /* -1 means until EOF */
+};
+
+struct url
+{
+	char *path;
+	unsigned long cumweight;
+};
+
+char *host = "localhost";
+char *port = NULL;
+int concurrency = 16;
+int duration = 10;
+long long maxrequests = 0;
+int keepalive = 0;
+int pipeline = 1;
+struct url urls[URLMAX];
+int nurls = 0;
+unsigned long totalweight = 0;
+
+struct sockaddr_in server;
+int protonum;
+int epfd;
+struct client *clients;
+unsigned long long hist[HISTLEN];
+long long issued, completed, errors, dropped, connects, bytesin;
+long long latmax, latsum;
+int stopping;
+
+void usage(char *progname)
+{
+	fprintf(stderr, "%s -p port [-s host] [-c conns] [-d secs] [-n reqs] [-k] [-P depth] [-u path] [-f urlfile]\n", progname);
+	fprintf(stderr, "   -s S  server host \'S\' (default localhost)\n");
+	fprintf(stderr, "   -p P  server port \'P\'\n");
+	fprintf(stderr, "   -c C  keep \'C\' connections open at once (default 16)\n");
+	fprintf(stderr, "   -d D  run for \'D\' seconds (default 10)\n");
+	fprintf(stderr, "   -n N  stop after \'N\' requests\n");
+	fprintf(stderr, "   -k    reuse connections (keep-alive)\n");
+	fprintf(stderr, "   -P P  pipeline up to \'P\' requests per connection, implies -k\n");
+	fprintf(stderr, "   -u U  request path \'U\', may be repeated\n");
+	fprintf(stderr, "   -f F  read the URL mix from \'F\', one \"[weight] path\" per line\n");
+	exit(ERROR);
+}
+
+int errexit(char *format, char *arg)
+{
+	fprintf(stderr, format, arg);
+	fprintf(stderr, "\n");
+	exit(ERROR);
+}
+
+void addurl(char *path, unsigned long weight)
+{
+	if (nurls >= URLMAX)
+		errexit("error: more than %s URLs", "1024");
+	if ((urls[nurls].path = strdup(path)) == NULL)
+		errexit("error: cannot allocate URL", NULL);
+	totalweight += weight;
+	urls[nurls].cumweight = totalweight;
+	nurls++;
+}
+
+void readurlfile(char *filename)
+{
+	char line[REQLEN], path[REQLEN];
+	unsigned long weight;
+	FILE *file;
+
+	if ((file = fopen(filename, "r")) == NULL)
+		errexit("error: cannot open URL file %s", filename);
+	while (fgets(line, REQLEN, file) != NULL)
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%lu %1023s", &weight, path) == 2)
+			addurl(path, weight);
+		else if (sscanf(line, "%1023s", path) == 1)
+			addurl(path, 1);
+	}
+	fclose(file);
+}
+
+void parseargs(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:p:c:d:n:kP:u:f:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			host = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'c':
+			concurrency = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'n':
+			maxrequests = atoll(optarg);
+			break;
+		case 'k':
+			keepalive = 1;
+			break;
+		case 'P':
+			pipeline = atoi(optarg);
+			keepalive = 1;
+			break;
+		case 'u':
+			addurl(optarg, 1);
+			break;
+		case 'f':
+			readurlfile(optarg);
+			break;
+		case '?':
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (port == NULL || concurrency < 1 || pipeline < 1 || pipeline > PIPEMAX)
+		usage(argv[0]);
+	if (nurls == 0)
+		addurl("/", 1);
+}
+
+long long now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int histindex(unsigned long long v)
+{
+	int shift = 0;
+
+	while ((v >> shift) >= SUBCOUNT)
+		shift++;
+	if (shift > MAXSHIFT)
+		return HISTLEN - 1;
+	return (shift == 0) ? (int)v : (shift * HALFCOUNT) + (int)(v >> shift);
+}
+
+/* highest value that lands in bucket i */
+unsigned long long histvalue(int i)
+{
+	int shift;
+
+	if (i < SUBCOUNT)
+		return i;
+	shift = i / HALFCOUNT - 1;
+	return ((unsigned long long)(i - shift * HALFCOUNT + 1) << shift) - 1;
+}
+
+void record(long long start)
+{
+	long long us = (now() - start) / 1000;
+
+	hist[histindex(us)]++;
+	latsum += us;
+	if (us > latmax)
+		latmax = us;
+}
+
+unsigned long long percentile(double p)
+{
+	unsigned long long want = (unsigned long long)(p / 100.0 * completed + 0.5), seen = 0;
+
+	if (want == 0)
+		want = 1;
+	for (int i = 0; i < HISTLEN; i++)
+	{
+		seen += hist[i];
+		if (seen >= want)
+			return (histvalue(i) < (unsigned long long)latmax) ? histvalue(i) : (unsigned long long)latmax;
+	}
+	return latmax;
+}
+
+void resolve()
+{
+	struct hostent *hinfo;
+	struct protoent *protoinfo;
+
+	/* lookup the hostname */
+	hinfo = gethostbyname(host);
+	if (hinfo == NULL)
+		errexit("error: cannot find host: %s", host);
+
+	/* set endpoint information */
+	memset((char *)&server, 0x0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(atoi(port));
+	memcpy((char *)&server.sin_addr, hinfo->h_addr, hinfo->h_length);
+
+	if ((protoinfo = getprotobyname(PROTOCOL)) == NULL)
+		errexit("error: cannot find protocol information for %s", PROTOCOL);
+	protonum = protoinfo->p_proto;
+}
+
+void watch(struct client *cl, int op, unsigned int events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = cl;
+	if (epoll_ctl(epfd, op, cl->sd, &ev) < 0)
+		errexit("error: cannot watch socket", NULL);
+}
+
+void openclient(struct client *cl)
+{
+	/* allocate a non-blocking socket and start connecting */
+	cl->sd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, protonum);
+	if (cl->sd < 0)
+		errexit("error: cannot create socket", NULL);
+	cl->connstart = now();
+	connects++;
+	if (connect(cl->sd, (struct sockaddr *)&server, sizeof(server)) < 0 && errno != EINPROGRESS)
+		errexit("error: cannot connect socket", NULL);
+
+	cl->state = CL_CONNECTING;
+	cl->onconn = 0;
+	cl->head = cl->count = 0;
+	cl->outlen = cl->outoff = 0;
+	cl->inlen = 0;
+	cl->inheader = 1;
+	watch(cl, EPOLL_CTL_ADD, EPOLLOUT | EPOLLIN);
+}
+
+void closeclient(struct client *cl)
+{
+	/* requests still in flight on a dead connection are lost */
+	dropped += cl->count;
+	close(cl->sd);
+	cl->state = CL_CLOSED;
+	if (!stopping)
+		openclient(cl);
+}
+
+int finished()
+{
+	if (maxrequests > 0 && issued >= maxrequests)
+		return 1;
+	return stopping;
+}
+
+char *pickurl()
+{
+	unsigned long r = random() % totalweight;
+	int lo = 0, hi = nurls - 1;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (urls[mid].cumweight > r)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return urls[lo].path;
+}
+
+/* queue requests up to the pipeline depth, then write what the socket takes */
+int fill(struct client *cl)
+{
+	int depth = keepalive ? pipeline : 1;
+	ssize_t bytes;
+
+	while (cl->count < depth && !finished() && (keepalive || cl->onconn == 0) && cl->outlen + REQLEN <= sizeof(cl->out))
+	{
+		cl->outlen += snprintf(cl->out + cl->outlen, REQLEN, "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: proj3-loadgen\r\n%s\r\n",
+							   pickurl(), host, keepalive ? "" : "Connection: close\r\n");
+		/* the first request on a new connection pays for the handshake too */
+		cl->sent[(cl->head + cl->count) % PIPEMAX] = (cl->onconn == 0) ? cl->connstart : now();
+		cl->count++;
+		cl->onconn++;
+		issued++;
+	}
+
+	while (cl->outoff < cl->outlen)
+	{
+		bytes = write(cl->sd, cl->out + cl->outoff, cl->outlen - cl->outoff);
+		if (bytes < 0 && errno == EAGAIN)
+			break;
+		if (bytes <= 0)
+			return ERROR;
+		cl->outoff += bytes;
+	}
+	if (cl->outoff == cl->outlen)
+		cl->outoff = cl->outlen = 0;
+	watch(cl, EPOLL_CTL_MOD, EPOLLIN | (cl->outlen > 0 ? EPOLLOUT : 0));
+	return SUCCESS;
+}
+
+void complete(struct client *cl)
+{
+	record(cl->sent[cl->head]);
+	cl->head = (cl->head + 1) % PIPEMAX;
+	cl->count--;
+	completed++;
+	if (cl->status < 200 || cl->status > 299)
+		errors++;
+	cl->inheader = 1;
+}
+
+long long headerlength(char *head, char *name)
+{
+	char *line = head;
+
+	while ((line = strstr(line, "\r\n")) != NULL && line[2] != '\r')
+	{
+		line += 2;
+		if (strncasecmp(line, name, strlen(name)) == 0)
+			return atoll(line + strlen(name));
+	}
+	return -1;
+}
+
+int hasclose(char *head)
+{
+	char *line = head;
+
+	while ((line = strstr(line, "\r\n")) != NULL && line[2] != '\r')
+	{
+		line += 2;
+		if (strncasecmp(line, "Connection: close", 17) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* consume whole responses from the input buffer, returns ERROR to drop the connection */
+int consume(struct client *cl)
+{
+	size_t used = 0;
+
+	while (used < cl->inlen && cl->count > 0)
+	{
+		if (cl->inheader)
+		{
+			char *start = cl->in + used;
+			char *end;
+
+			cl->in[cl->inlen] = '\0';
+			if ((end = strstr(start, HEAD_END)) == NULL)
+				break;
+			end[2] = '\0';
+			cl->status = (strncmp(start, "HTTP/", 5) == 0 && strchr(start, ' ') != NULL) ? atoi(strchr(start, ' ') + 1) : 0;
+			cl->bodyleft = headerlength(start, "Content-Length:");
+			cl->closeafter = hasclose(start);
+			used += (end - start) + 4;
+			cl->inheader = 0;
+		}
+		if (cl->bodyleft < 0)
+		{
+			/* body runs to EOF */
+			used = cl->inlen;
+			break;
+		}
+		size_t take = (cl->inlen - used < (size_t)cl->bodyleft) ? cl->inlen - used : (size_t)cl->bodyleft;
+		used += take;
+		cl->bodyleft -= take;
+		if (cl->bodyleft == 0)
+		{
+			complete(cl);
+			if (cl->closeafter || !keepalive)
+				return ERROR;
+		}
+	}
+
+	memmove(cl->in, cl->in + used, cl->inlen - used);
+	cl->inlen -= used;
+	if (cl->inlen >= BUFLEN - 1)
+		return ERROR;
+	return SUCCESS;
+}
+
+void readable(struct client *cl)
+{
+	ssize_t bytes;
+
+	while ((bytes = read(cl->sd, cl->in + cl->inlen, BUFLEN - 1 - cl->inlen)) > 0)
+	{
+		bytesin += bytes;
+		cl->inlen += bytes;
+		if (consume(cl) != SUCCESS)
+		{
+			closeclient(cl);
+			return;
+		}
+	}
+	if (bytes == 0)
+	{
+		if (!cl->inheader && cl->bodyleft < 0 && cl->count > 0)
+		{
+			complete(cl);
+		}
+		closeclient(cl);
+		return;
+	}
+	if (errno != EAGAIN)
+	{
+		closeclient(cl);
+		return;
+	}
+	if (fill(cl) != SUCCESS)
+		closeclient(cl);
+}
+
+void writable(struct client *cl)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (cl->state == CL_CONNECTING)
+	{
+		if (getsockopt(cl->sd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+		{
+			errors++;
+			closeclient(cl);
+			return;
+		}
+		/* the event may belong to the socket this one replaced */
+		struct sockaddr_in peer;
+		len = sizeof(peer);
+		if (getpeername(cl->sd, (struct sockaddr *)&peer, &len) < 0)
+			return;
+		cl->state = CL_ACTIVE;
+	}
+	if (fill(cl) != SUCCESS)
+		closeclient(cl);
+}
+
+void report(long long elapsed)
+{
+	double secs = elapsed / 1e9;
+
+	printf("requests:  %lld completed, %lld non-2xx, %lld dropped, %lld connections\n", completed, errors, dropped, connects);
+	printf("duration:  %.3f s\n", secs);
+	printf("throughput: %.1f req/s, %.2f MB/s\n", completed / secs, bytesin / secs / 1e6);
+	if (completed == 0)
+		return;
+	printf("latency (us): mean %.0f p50 %llu p90 %llu p99 %llu p999 %llu max %lld\n", (double)latsum / completed,
+		   percentile(50.0), percentile(90.0), percentile(99.0), percentile(99.9), latmax);
+}
+
+int main(int argc, char *argv[])
+{
+	struct epoll_event events[256];
+	long long start, deadline;
+	int n, active;
+
+	parseargs(argc, argv);
+	signal(SIGPIPE, SIG_IGN);
+	resolve();
+
+	if ((epfd = epoll_create1(0)) < 0)
+		errexit("error: cannot create epoll instance", NULL);
+	if ((clients = calloc(concurrency, sizeof(struct client))) == NULL)
+		errexit("error: cannot allocate connections", NULL);
+
+	start = now();
+	deadline = start + (long long)duration * 1000000000LL;
+	for (int i = 0; i < concurrency; i++)
+		openclient(&clients[i]);
+
+	active = concurrency;
+	while (active > 0)
+	{
+		n = epoll_wait(epfd, events, 256, 100);
+		if (n < 0 && errno != EINTR)
+			errexit("error: epoll_wait failed", NULL);
+		for (int i = 0; i < n; i++)
+		{
+			struct client *cl = events[i].data.ptr;
+			if (cl->state == CL_CLOSED)
+				continue;
+			if (cl->state == CL_CONNECTING)
+			{
+				if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+					writable(cl);
+				continue;
+			}
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				readable(cl);
+			if (cl->state == CL_ACTIVE && (events[i].events & EPOLLOUT))
+				writable(cl);
+		}
+
+		if (!stopping && now() >= deadline)
+			stopping = 1;
+		if (maxrequests > 0 && completed + dropped >= maxrequests)
+			stopping = 1;
+
+		/* once stopping, close connections as they drain */
+		active = 0;
+		for (int i = 0; i < concurrency; i++)
+		{
+			if (clients[i].state == CL_CLOSED)
+				continue;
+			if (stopping && (clients[i].count == 0 || now() >= deadline + 1000000000LL))
+			{
+				dropped += clients[i].count;
+				clients[i].count = 0;
+				close(clients[i].sd);
+				clients[i].state = CL_CLOSED;
+			}
+			else
+				active++;
+		}
+	}
+
+	report(now() - start);
+	exit(SUCCESS);
+}
@@ -0,0 +1,61 @@
+// Ben Smith malloccount.c count heap allocations, linked into proj3-count only
+
+#include <stddef.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+/* glibc's own allocator, still reachable once malloc itself is replaced */
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+
+static unsigned long long allocs = 0;
+
+/* replacing malloc here catches every caller, libc's internal ones included */
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(p, size);
+}
+
+int posix_memalign(void **p, size_t align, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	*p = __libc_memalign(align, size);
+	return (*p == NULL) ? ENOMEM : 0;
+}
+
+/* SIGUSR2 writes the count so far to stderr, formatted by hand to stay signal safe */
+static void report(int sig)
+{
+	char buf[32], *s = buf + sizeof(buf);
+	unsigned long long n = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+
+	*--s = '\n';
+	do
+	{
+		*--s = '0' + n % 10;
+		n /= 10;
+	} while (n > 0);
+	if (write(2, s, buf + sizeof(buf) - s) < 0)
+		return;
+}
+
+__attribute__((constructor)) static void setup()
+{
+	signal(SIGUSR2, report);
+}
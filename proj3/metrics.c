@@ -0,0 +1,196 @@
+// Ben Smith metrics.c per-thread request counters for proj3
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+
+/* relaxed atomics, the owner is the only writer so load + store is enough */
+#define BUMP(x, n) __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+#define PEEK(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static char *methodnames[NMETHODS] = {"GET", "SHUTDOWN", "other"};
+static int statuscodes[NSTATUS] = {200, 206, 304, 400, 403, 404, 405, 406, 416, 501, 503, 0};
+static struct metrics *threads = NULL;
+static int nthreads = 0;
+
+void metricsinit(int n)
+{
+	if (posix_memalign((void **)&threads, 64, n * sizeof(struct metrics)) != 0)
+	{
+		fprintf(stderr, "error: cannot allocate metrics\n");
+		exit(1);
+	}
+	memset(threads, 0x0, n * sizeof(struct metrics));
+	nthreads = n;
+}
+
+struct metrics *metricsfor(int thread)
+{
+	return &threads[thread];
+}
+
+static int statusindex(int status)
+{
+	for (int i = 0; i < NSTATUS - 1; i++)
+	{
+		if (statuscodes[i] == status)
+			return i;
+	}
+	return NSTATUS - 1;
+}
+
+static int latindex(unsigned long long v)
+{
+	int shift = 0;
+
+	while ((v >> shift) >= LATSUBCOUNT)
+		shift++;
+	if (shift > LATMAXSHIFT)
+		return LATBUCKETS - 1;
+	return (shift == 0) ? (int)v : (shift * LATHALF) + (int)(v >> shift);
+}
+
+/* highest value that lands in bucket i */
+static unsigned long long latvalue(int i)
+{
+	int shift;
+
+	if (i < LATSUBCOUNT)
+		return i;
+	shift = i / LATHALF - 1;
+	return ((unsigned long long)(i - shift * LATHALF + 1) << shift) - 1;
+}
+
+void countrequest(struct metrics *m, int method, int status, unsigned long long bytes, long long usecs)
+{
+	int s = statusindex(status);
+
+	if (usecs < 0)
+		usecs = 0;
+	BUMP(m->requests[method][s], 1);
+	BUMP(m->bytes, bytes);
+	BUMP(m->latency[latindex(usecs)], 1);
+	BUMP(m->latsum, usecs);
+	if ((unsigned long long)usecs > m->latmax)
+		__atomic_store_n(&m->latmax, usecs, __ATOMIC_RELAXED);
+}
+
+void countconn(struct metrics *m, int delta)
+{
+	BUMP(m->active, delta);
+}
+
+void countdrop(struct metrics *m)
+{
+	BUMP(m->acceptdrops, 1);
+}
+
+void countlogdrop(struct metrics *m)
+{
+	BUMP(m->logdrops, 1);
+}
+
+/* sum every thread's counters into one snapshot, the totals may be a few
+   requests apart from each other but never torn */
+static void snapshot(struct metrics *total)
+{
+	memset(total, 0x0, sizeof(struct metrics));
+	for (int t = 0; t < nthreads; t++)
+	{
+		struct metrics *m = &threads[t];
+		for (int i = 0; i < NMETHODS; i++)
+			for (int j = 0; j < NSTATUS; j++)
+				total->requests[i][j] += PEEK(m->requests[i][j]);
+		total->bytes += PEEK(m->bytes);
+		total->active += PEEK(m->active);
+		total->acceptdrops += PEEK(m->acceptdrops);
+		total->logdrops += PEEK(m->logdrops);
+		for (int i = 0; i < LATBUCKETS; i++)
+			total->latency[i] += PEEK(m->latency[i]);
+		total->latsum += PEEK(m->latsum);
+		if (PEEK(m->latmax) > total->latmax)
+			total->latmax = PEEK(m->latmax);
+	}
+}
+
+static unsigned long long percentile(struct metrics *m, unsigned long long count, double p)
+{
+	unsigned long long want = (unsigned long long)(p / 100.0 * count + 0.5), seen = 0;
+
+	if (want == 0)
+		want = 1;
+	for (int i = 0; i < LATBUCKETS; i++)
+	{
+		seen += m->latency[i];
+		if (seen >= want)
+			return (latvalue(i) < m->latmax) ? latvalue(i) : m->latmax;
+	}
+	return m->latmax;
+}
+
+/* render the totals as Prometheus-style text or JSON, returns bytes written */
+int formatmetrics(char *buf, size_t len, int json)
+{
+	struct metrics *total;
+	unsigned long long count = 0;
+	size_t n = 0;
+	int first = 1;
+
+	/* too big for a worker's stack */
+	if ((total = malloc(sizeof(struct metrics))) == NULL)
+		return -1;
+	snapshot(total);
+	for (int i = 0; i < LATBUCKETS; i++)
+		count += total->latency[i];
+
+#define OUT(...)                                          \
+	do                                                    \
+	{                                                     \
+		if (n < len)                                      \
+			n += snprintf(buf + n, len - n, __VA_ARGS__); \
+	} while (0)
+
+	if (json)
+		OUT("{\"threads\":%d,\"requests\":[", nthreads);
+	for (int i = 0; i < NMETHODS; i++)
+	{
+		for (int j = 0; j < NSTATUS; j++)
+		{
+			if (total->requests[i][j] == 0)
+				continue;
+			if (json)
+				OUT("%s{\"method\":\"%s\",\"status\":%d,\"count\":%llu}", first ? "" : ",", methodnames[i], statuscodes[j], total->requests[i][j]);
+			else
+				OUT("proj3_requests_total{method=\"%s\",status=\"%d\"} %llu\n", methodnames[i], statuscodes[j], total->requests[i][j]);
+			first = 0;
+		}
+	}
+	if (json)
+	{
+		OUT("],\"bytes_sent\":%llu,\"active_connections\":%lld,\"accept_drops\":%llu,\"log_drops\":%llu,", total->bytes, total->active,
+			total->acceptdrops, total->logdrops);
+		OUT("\"latency_us\":{\"count\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+			count, count ? total->latsum / count : 0, percentile(total, count, 50.0), percentile(total, count, 90.0),
+			percentile(total, count, 99.0), percentile(total, count, 99.9), total->latmax);
+	}
+	else
+	{
+		OUT("proj3_threads %d\n", nthreads);
+		OUT("proj3_bytes_sent_total %llu\n", total->bytes);
+		OUT("proj3_active_connections %lld\n", total->active);
+		OUT("proj3_accept_drops_total %llu\n", total->acceptdrops);
+		OUT("proj3_log_drops_total %llu\n", total->logdrops);
+		OUT("proj3_latency_us_count %llu\n", count);
+		OUT("proj3_latency_us_sum %llu\n", total->latsum);
+		OUT("proj3_latency_us{quantile=\"0.5\"} %llu\n", percentile(total, count, 50.0));
+		OUT("proj3_latency_us{quantile=\"0.9\"} %llu\n", percentile(total, count, 90.0));
+		OUT("proj3_latency_us{quantile=\"0.99\"} %llu\n", percentile(total, count, 99.0));
+		OUT("proj3_latency_us{quantile=\"0.999\"} %llu\n", percentile(total, count, 99.9));
+		OUT("proj3_latency_us_max %llu\n", total->latmax);
+	}
+#undef OUT
+
+	free(total);
+	return (n < len) ? (int)n : (int)len - 1;
+}
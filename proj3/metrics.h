@@ -0,0 +1,34 @@
+#define M_GET 0
+#define M_SHUTDOWN 1
+#define M_OTHER 2
+#define NMETHODS 3
+#define NSTATUS 12           /* codes the server sends, plus "other" */
+
+/* request latency histogram in microseconds, log-linear like loadgen's */
+#define LATSUBBITS 5
+#define LATSUBCOUNT (1 << LATSUBBITS)
+#define LATHALF (LATSUBCOUNT / 2)
+#define LATMAXSHIFT 32
+#define LATBUCKETS ((LATMAXSHIFT + 2) * LATHALF)
+
+/* counters owned by one worker thread, only that thread ever writes them,
+   readers sum all threads with relaxed loads so nothing takes a lock */
+struct metrics
+{
+    unsigned long long requests[NMETHODS][NSTATUS];
+    unsigned long long bytes;
+    long long active;            /* connections currently open */
+    unsigned long long acceptdrops;
+    unsigned long long logdrops; /* access log records lost to a full ring */
+    unsigned long long latency[LATBUCKETS];
+    unsigned long long latsum;
+    unsigned long long latmax;
+} __attribute__((aligned(64)));
+
+void metricsinit(int nthreads);
+struct metrics *metricsfor(int thread);
+void countrequest(struct metrics *m, int method, int status, unsigned long long bytes, long long usecs);
+void countconn(struct metrics *m, int delta);
+void countdrop(struct metrics *m);
+void countlogdrop(struct metrics *m);
+int formatmetrics(char *buf, size_t len, int json);
@@ -0,0 +1,182 @@
+// Ben Smith pathcache.c resolve request paths beneath the document root
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include "pathcache.h"
+
+static int noopenat2 = 0;
+
+/* the root is opened once, every request path is resolved relative to it */
+int pathroot(const char *directory)
+{
+	return open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+void pathinit(struct pathcache *pc, int rootfd)
+{
+	pc->rootfd = rootfd;
+	memset(pc->slots, 0x0, sizeof(pc->slots));
+}
+
+/* true if any component of path is "..", only needed without openat2 */
+static int climbs(const char *path)
+{
+	const char *s = path;
+
+	while (*s != '\0')
+	{
+		if (s[0] == '.' && s[1] == '.' && (s[2] == '/' || s[2] == '\0'))
+			return 1;
+		while (*s != '\0' && *s != '/')
+			s++;
+		while (*s == '/')
+			s++;
+	}
+	return 0;
+}
+
+/* open path (NUL terminated, relative) so that it cannot resolve outside the root,
+   neither through ".." nor through a symlink, fills in e's fd, st and err */
+static void resolve(int rootfd, const char *path, struct pathentry *e)
+{
+	struct open_how how;
+
+	memset(&how, 0x0, sizeof(how));
+	how.flags = O_RDONLY | O_CLOEXEC;
+	how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+	e->fd = -1;
+	if (!noopenat2)
+	{
+		e->fd = syscall(SYS_openat2, rootfd, path, &how, sizeof(how));
+		if (e->fd < 0 && errno == ENOSYS)
+			noopenat2 = 1;
+	}
+	/* older kernels: refuse ".." outright, symlinks are trusted */
+	if (noopenat2)
+	{
+		if (climbs(path))
+			errno = EXDEV;
+		else
+			e->fd = openat(rootfd, path, O_RDONLY | O_CLOEXEC);
+	}
+	e->err = (e->fd < 0) ? errno : 0;
+	if (e->fd >= 0 && fstat(e->fd, &e->st) < 0)
+	{
+		e->err = errno;
+		close(e->fd);
+		e->fd = -1;
+	}
+}
+
+static void dropentry(struct pathentry *e)
+{
+	e->cached = 0;
+	if (e->refs > 0)
+		return;
+	if (e->fd >= 0)
+		close(e->fd);
+	free(e);
+}
+
+static unsigned int hash(const char *path, unsigned int len)
+{
+	unsigned int h = 2166136261u;
+
+	for (unsigned int i = 0; i < len; i++)
+		h = (h ^ (unsigned char)path[i]) * 16777619u;
+	return h;
+}
+
+static int samefile(struct pathentry *a, struct pathentry *b)
+{
+	if (a->err != b->err)
+		return 0;
+	return (a->fd < 0 || (a->st.st_ino == b->st.st_ino && a->st.st_dev == b->st.st_dev && a->st.st_size == b->st.st_size &&
+						  a->st.st_mtim.tv_sec == b->st.st_mtim.tv_sec && a->st.st_mtim.tv_nsec == b->st.st_mtim.tv_nsec));
+}
+
+/* the entry for path[0, len) with a reference taken, check fd and err;
+   NULL only when out of memory
+   hits within PATHTTL of the last check cost no system calls, after that the path
+   is resolved again and the entry replaced if it now names a different file
+   entries are reused in place, so only a slot whose entry is still being sent
+   from, or a path too long to cache, needs a new allocation */
+struct pathentry *pathopen(struct pathcache *pc, const char *path, unsigned int len, long long now)
+{
+	struct pathentry **slot = &pc->slots[hash(path, len) % PATHSLOTS];
+	struct pathentry *e = *slot, fresh;
+	char longpath[PATH_MAX];
+
+	if (e != NULL && e->len == len && memcmp(e->path, path, len) == 0 && now - e->checked < PATHTTL)
+	{
+		e->refs++;
+		return e;
+	}
+
+	if (len >= PATHKEY)
+	{
+		/* resolved every time and freed with its last reference */
+		if (len >= PATH_MAX || (e = malloc(sizeof(struct pathentry))) == NULL)
+			return NULL;
+		memcpy(longpath, path, len);
+		longpath[len] = '\0';
+		resolve(pc->rootfd, longpath, e);
+		e->len = len;
+		e->checked = now;
+		e->refs = 1;
+		e->cached = 0;
+		return e;
+	}
+
+	memcpy(fresh.path, path, len);
+	fresh.path[len] = '\0';
+	resolve(pc->rootfd, fresh.path, &fresh);
+
+	/* same file as before: keep the old entry and its descriptor, just trust it longer */
+	if (e != NULL && e->len == len && memcmp(e->path, path, len) == 0 && samefile(e, &fresh))
+	{
+		if (fresh.fd >= 0)
+			close(fresh.fd);
+		e->checked = now;
+		e->refs++;
+		return e;
+	}
+
+	if (e != NULL && e->refs == 0)
+	{
+		if (e->fd >= 0)
+			close(e->fd);
+	}
+	else
+	{
+		/* a response still reads from the old entry, it goes once that is done */
+		*slot = NULL;
+		if (e != NULL)
+			dropentry(e);
+		if ((e = malloc(sizeof(struct pathentry))) == NULL)
+		{
+			if (fresh.fd >= 0)
+				close(fresh.fd);
+			return NULL;
+		}
+	}
+	*e = fresh;
+	e->len = len;
+	e->checked = now;
+	e->refs = 1;
+	e->cached = 1;
+	*slot = e;
+	return e;
+}
+
+void pathrelease(struct pathentry *e)
+{
+	if (--e->refs == 0 && !e->cached)
+		dropentry(e);
+}
@@ -0,0 +1,30 @@
+#include <sys/stat.h>
+
+#define PATHSLOTS 1024              /* cached paths per worker */
+#define PATHKEY 256                 /* longer paths are resolved every time */
+#define PATHTTL 1000000000LL        /* ns an entry is trusted before it is checked again */
+
+/* an open file under the document root, or a remembered failure */
+struct pathentry
+{
+    char path[PATHKEY];
+    unsigned int len;
+    int fd;                     /* -1 when err is set */
+    int err;                    /* errno of the failed open */
+    struct stat st;
+    long long checked;          /* when it was last resolved */
+    int refs;                   /* requests using fd */
+    int cached;                 /* still in its slot, otherwise freed with the last ref */
+};
+
+/* one per worker, so lookups never lock */
+struct pathcache
+{
+    int rootfd;
+    struct pathentry *slots[PATHSLOTS];
+};
+
+int pathroot(const char *directory);
+void pathinit(struct pathcache *pc, int rootfd);
+struct pathentry *pathopen(struct pathcache *pc, const char *path, unsigned int len, long long now);
+void pathrelease(struct pathentry *e);
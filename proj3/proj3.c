@@ -1,5 +1,6 @@
 // Ben Smith proj3.c 10/23/2024 simple socket-based HTTP server
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
@@ -8,43 +9,246 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "httpparse.h"
+#include "range.h"
+#include "gzcache.h"
+#include "metrics.h"
+#include "handoff.h"
+#include "accesslog.h"
+#include "timerwheel.h"
+#include "uring.h"
+#include "pathcache.h"
 
 #define SUCCESS 0
 #define ERROR 1
 #define BUFFLEN 1024
 #define PROTOCOL "tcp"
-#define QLEN 1
-#define BADREQ "HTTP/1.1 400 Malformed Request\r\n\r\n"
-#define NOTIMPL "HTTP/1.1 501 Protocol Not Implemented\r\n\r\n"
-#define UNSUPD "HTTP/1.1 405 Unsupported Method\r\n\r\n"
-#define SHUTDN "HTTP/1.1 200 Server Shutting Down\r\n\r\n"
-#define FORBDN "HTTP/1.1 403 Operation Forbidden\r\n\r\n"
-#define BADFILE "HTTP/1.1 406 Invalid Filename\r\n\r\n"
-#define OK "HTTP/1.1 200 OK\r\n\r\n"
-#define NOTFND "HTTP/1.1 404 File Not Found\r\n\r\n"
-#define HEADEND "\r\n\r\n"
-
-typedef struct Request
-{
-	char *method, *arg, *protocol;
-} Request;
+#define QLEN 128
+#define BADREQ "HTTP/1.1 400 Malformed Request\r\n"
+#define NOTIMPL "HTTP/1.1 501 Protocol Not Implemented\r\n"
+#define UNSUPD "HTTP/1.1 405 Unsupported Method\r\n"
+#define SHUTDN "HTTP/1.1 200 Server Shutting Down\r\n"
+#define FORBDN "HTTP/1.1 403 Operation Forbidden\r\n"
+#define BADFILE "HTTP/1.1 406 Invalid Filename\r\n"
+#define OK "HTTP/1.1 200 OK\r\n"
+#define PARTIAL "HTTP/1.1 206 Partial Content\r\n"
+#define BADRANGE "HTTP/1.1 416 Range Not Satisfiable\r\n"
+#define NOTMOD "HTTP/1.1 304 Not Modified\r\n"
+#define NOTFND "HTTP/1.1 404 File Not Found\r\n"
+#define TOOMANY "HTTP/1.1 503 Too Many Connections\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HDRLIMIT 8192
+#define SENDCHUNK (1 << 20)
+#define BOUNDARY "proj3-byteranges"
+#define HTTPDATE "%a, %d %b %Y %H:%M:%S GMT"
+#define STATSPATH "/_stats"
+#define STATSLEN 16384
+#define MAXWORKERS 256
+#define OUTLEN 4096                 /* response headers, multipart part headers included */
+#define SEGMAX (2 * RANGEMAX + 2)
+#define MAXEVENTS 64
+#define CONNSLAB 64                 /* conns allocated together when the pool runs dry */
+#define ACCEPTBATCH 64              /* accepts per wakeup before serving what we have */
+#define TICKMS 100                  /* timer wheel resolution */
+#define HEADERWAIT 10               /* seconds to get a whole request header in */
+#define SENDWAIT 30                 /* seconds a response may go without progress */
+#define IDLEWAIT 5                  /* seconds a kept-alive connection may sit idle */
+#define PERIPMAX 256
+#define IPSLOTS 65536
+
+/* where a connection is in its request cycle */
+#define CS_IDLE 0                   /* waiting for a request, idle deadline */
+#define CS_READ 1                   /* request header partly in, header deadline */
+#define CS_SEND 2                   /* response queued, send deadline */
+#define CS_CLOSED 3                 /* freed after the current batch of events */
+
+#define BACKEND_EPOLL 0
+#define BACKEND_URING 1
+#define URINGDEPTH 1024             /* submission queue entries per worker */
+#define STAGELEN (64 * 1024)        /* file bytes moved per linked read and send */
+#define STAGES 32                   /* registered staging buffers per worker */
+
+/* io_uring request kinds, kept in the low bits of user_data under the conn pointer */
+#define UOP_RECV 1
+#define UOP_SEND 2
+#define UOP_READ 3
+
+/* what a connection's io_uring requests in flight are doing */
+#define STEP_NONE 0
+#define STEP_RECV 1                 /* reading the request */
+#define STEP_SEND 2                 /* sending a memory segment */
+#define STEP_FILE 3                 /* file read into a stage, linked to its send */
+#define STEP_STAGE 4                /* sending what a short send left in the stage */
+
+#define PUMP_DONE 0
+#define PUMP_MORE 1
+#define PUMP_ERROR 2
+
+#define CONNHDR(c) ((c)->keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n")
+
+/* a piece of a queued response: bytes at data + off, or a file region sent
+   with sendfile(2) when data is NULL */
+struct segment
+{
+	const char *data;
+	int fd;
+	off_t off;
+	off_t len;
+};
+
+/* one client connection, request spans point into buf
+   a conn is its own arena: the parsed request, the queued response headers and
+   the read buffer all live in the one fixed-size block, which comes from the
+   worker's slab pool and goes back to it when the connection closes */
+struct conn
+{
+	int sd;
+	int state;                  /* CS_* */
+	unsigned int events;        /* epoll interest currently registered */
+	unsigned int len;
+	struct httpparser parser;
+	int method;                 /* M_GET, M_SHUTDOWN or M_OTHER */
+	int status;                 /* status code of the response sent, 0 if none yet */
+	int keepalive;              /* serve another request after this one */
+	unsigned long long sent;    /* response bytes written */
+	long long start;            /* when the request's first bytes arrived */
+	struct sockaddr_storage peer;
+	int thread;                 /* index of the worker serving it */
+	struct metrics *metrics;    /* counters of the thread serving it */
+	struct worker *w;
+	struct timer timer;         /* whichever deadline the state has */
+	struct conn *prev;          /* the worker's connections */
+	struct conn *next;
+	/* the response, queued whole and written out as the socket takes it */
+	char out[OUTLEN];
+	unsigned int outlen;
+	struct segment segs[SEGMAX];
+	int nsegs;
+	int seg;                    /* first segment not fully sent */
+	struct pathentry *file;     /* files and cache entry the segments refer to */
+	struct pathentry *gzfile;
+	struct gzentry *gz;
+	char *extra;                /* a generated body, freed with the response */
+	/* io_uring backend only */
+	int inflight;               /* requests the kernel still holds */
+	int closing;                /* closed once inflight reaches 0 */
+	int step;                   /* STEP_* */
+	int readres;                /* results of the step's requests */
+	int sendres;
+	int stage;                  /* staging buffer held, -1 if none */
+	unsigned int staged;        /* file bytes in it */
+	unsigned int stagesent;     /* and how many of those went out */
+	int waiting;                /* queued for a staging buffer */
+	struct conn *waitnext;
+	char buf[];                 /* header_limit bytes */
+};
+
+/* one event loop thread and everything it owns */
+struct worker
+{
+	int id;
+	int ep;
+	int draining;               /* stopped accepting, exits when conns is empty */
+	struct wheel wheel;
+	struct metrics *metrics;
+	struct conn *conns;
+	struct conn *dead;          /* closed during this batch of events */
+	struct conn *spare;         /* slab pool of closed conns, reused before allocating */
+	struct pathcache paths;
+	/* io_uring backend only */
+	struct uring ring;
+	char *stages;               /* STAGES buffers of STAGELEN, registered when allowed */
+	int fixed;
+	int accepting;              /* the multishot accept has not reported its end */
+	int freestages[STAGES];
+	int nfree;
+	struct conn *waithead;      /* connections waiting for a stage, oldest first */
+	struct conn *waittail;
+};
+
+/* what a GET sends: an open file or a cached buffer, and the file it came from */
+struct body
+{
+	int fd;
+	const char *data;           /* set instead of fd for cached encodings */
+	off_t size;
+	struct stat *st;            /* source of the validators */
+	char *encoding;             /* Content-Encoding, NULL for identity */
+	struct gzentry *gz;         /* cache entry backing data, if any */
+};
 
 char *port = NULL;
 char *directory = NULL;
+int rootfd;
 char *auth_token = NULL;
-char responsehead[BUFFLEN];
-int sd, sd2, alive;
+unsigned int header_limit = HDRLIMIT;
+size_t gzcache_limit = GZCACHEMAX;
+int nworkers = 0;
+char *control_path = NULL;
+int takeover = 0;
+char *log_path = NULL;
+off_t log_rotate = 0;
+int header_wait = HEADERWAIT;
+int send_wait = SENDWAIT;
+int idle_wait = IDLEWAIT;
+unsigned int perip_max = PERIPMAX;
+int backend = BACKEND_EPOLL;
+int ipv6only = 0;
+int sd;
+int wakefd[2];
+volatile int alive;
 unsigned short portnum;
-Request request;
+struct worker workers[MAXWORKERS];
+unsigned int ipconns[IPSLOTS];      /* open connections per hashed client address */
+int listener, waker;                /* epoll tags for sd and wakefd */
+
+long long now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+unsigned long ticks()
+{
+	return now() / (TICKMS * 1000000LL);
+}
+
+unsigned long deadline(int secs)
+{
+	return ticks() + (unsigned long)secs * 1000 / TICKMS;
+}
 
 void usage(char *progname)
 {
-	fprintf(stderr, "%s -p port -r directory -t auth_token\n", progname);
+	fprintf(stderr, "%s -p port -r directory -t auth_token [-H bytes] [-z bytes] [-w workers] [-u path [-R]] [-a logfile [-A bytes]]\n", progname);
+	fprintf(stderr, "   %*s [-T secs] [-S secs] [-K secs] [-m conns] [-b epoll|uring] [-6]\n", (int)strlen(progname), "");
 	fprintf(stderr, "   -p P  specify port \'P\' on which the server will run\n");
 	fprintf(stderr, "   -r R  specify directory \'R\' form which files will be served\n");
 	fprintf(stderr, "   -t T  specify access token \'T\' used to shutdown server\n");
+	fprintf(stderr, "   -H H  limit request headers to \'H\' bytes (default %d)\n", HDRLIMIT);
+	fprintf(stderr, "   -z Z  keep up to \'Z\' bytes of gzipped files, 0 disables (default %d)\n", GZCACHEMAX);
+	fprintf(stderr, "   -w W  serve connections on \'W\' threads (default one per CPU)\n");
+	fprintf(stderr, "   -u U  accept hot restarts on unix socket \'U\'\n");
+	fprintf(stderr, "   -R    take over the listening socket from the server on -u, then exit it\n");
+	fprintf(stderr, "   -a A  write an access log to \'A\', reopened on SIGHUP\n");
+	fprintf(stderr, "   -A A  rotate the access log to A.1 once it reaches \'A\' bytes\n");
+	fprintf(stderr, "   -T T  close connections that take over \'T\' seconds to send a request (default %d)\n", HEADERWAIT);
+	fprintf(stderr, "   -S S  close connections that take nothing for \'S\' seconds of a response (default %d)\n", SENDWAIT);
+	fprintf(stderr, "   -K K  close kept-alive connections idle for \'K\' seconds, 0 disables keep-alive (default %d)\n", IDLEWAIT);
+	fprintf(stderr, "   -m M  allow \'M\' open connections per client address, 0 for no limit (default %d)\n", PERIPMAX);
+	fprintf(stderr, "   -b B  serve with epoll and sendfile, or with io_uring (default epoll)\n");
+	fprintf(stderr, "   -6    listen on IPv6 instead of IPv4, another server can take IPv4 on the same port\n");
 	exit(ERROR);
 }
 
@@ -52,7 +256,7 @@ void parseargs(int argc, char *argv[])
 {
 	int opt;
 
-	while ((opt = getopt(argc, argv, "p:r:t:")) != -1)
+	while ((opt = getopt(argc, argv, "p:r:t:H:z:w:u:Ra:A:T:S:K:m:b:6")) != -1)
 	{
 		switch (opt)
 		{
@@ -65,6 +269,60 @@ void parseargs(int argc, char *argv[])
 		case 't':
 			auth_token = optarg;
 			break;
+		case 'H':
+			header_limit = strtoul(optarg, NULL, 10);
+			if (header_limit == 0)
+				usage(argv[0]);
+			break;
+		case 'z':
+			gzcache_limit = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			if (nworkers < 1 || nworkers > MAXWORKERS)
+				usage(argv[0]);
+			break;
+		case 'u':
+			control_path = optarg;
+			break;
+		case 'R':
+			takeover = 1;
+			break;
+		case 'a':
+			log_path = optarg;
+			break;
+		case 'A':
+			log_rotate = strtoll(optarg, NULL, 10);
+			break;
+		case 'T':
+			header_wait = atoi(optarg);
+			if (header_wait < 1)
+				usage(argv[0]);
+			break;
+		case 'S':
+			send_wait = atoi(optarg);
+			if (send_wait < 1)
+				usage(argv[0]);
+			break;
+		case 'K':
+			idle_wait = atoi(optarg);
+			if (idle_wait < 0)
+				usage(argv[0]);
+			break;
+		case 'm':
+			perip_max = strtoul(optarg, NULL, 10);
+			break;
+		case '6':
+			ipv6only = 1;
+			break;
+		case 'b':
+			if (strcmp(optarg, "epoll") == 0)
+				backend = BACKEND_EPOLL;
+			else if (strcmp(optarg, "uring") == 0)
+				backend = BACKEND_URING;
+			else
+				usage(argv[0]);
+			break;
 		case '?':
 		default:
 			usage(argv[0]);
@@ -83,7 +341,9 @@ int errexit(char *format, char *arg)
 void makesocket()
 {
 	struct sockaddr_in sin;
+	struct sockaddr_in6 sin6;
 	struct protoent *protoinfo;
+	int one = 1;
 
 	/* determine protocol */
 	if ((protoinfo = getprotobyname(PROTOCOL)) == NULL)
@@ -95,205 +355,1422 @@ void makesocket()
 	sin.sin_addr.s_addr = INADDR_ANY;
 	sin.sin_port = htons(portnum);
 
-	/* allocate a socket */
-	sd = socket(PF_INET, SOCK_STREAM, protoinfo->p_proto);
+	/* allocate a socket, non-blocking so workers can also watch wakefd
+	   the flag travels with the socket if it is handed to a new server */
+	sd = socket(ipv6only ? PF_INET6 : PF_INET, SOCK_STREAM | SOCK_NONBLOCK, protoinfo->p_proto);
 	if (sd < 0)
 		errexit("error: cannot create socket", NULL);
 
-	/* bind the socket */
-	if (bind(sd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+	/* bind the socket, an IPv6 one only to IPv6 so IPv4 on the port stays free */
+	if (ipv6only)
+	{
+		memset((char *)&sin6, 0x0, sizeof(sin6));
+		sin6.sin6_family = AF_INET6;
+		sin6.sin6_addr = in6addr_any;
+		sin6.sin6_port = htons(portnum);
+		if (setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one)) < 0 ||
+			bind(sd, (struct sockaddr *)&sin6, sizeof(sin6)) < 0)
+			errexit("error: cannot bind to port %s", port);
+	}
+	else if (bind(sd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
 		errexit("error: cannot bind to port %s", port);
+
+	/* listen for incoming connections, every worker accepts from this queue */
+	if (listen(sd, QLEN) < 0)
+		errexit("error: cannot listen on port %s", port);
 }
 
-void listensocket()
+/* the peer as an IPv6 address, an IPv4 one v4-mapped */
+void peer6(struct sockaddr_storage *peer, struct in6_addr *addr)
 {
-	struct sockaddr addr;
-	unsigned int addrlen;
+	if (peer->ss_family == AF_INET6)
+	{
+		*addr = ((struct sockaddr_in6 *)peer)->sin6_addr;
+		return;
+	}
+	memset(addr, 0x0, sizeof(*addr));
+	addr->s6_addr[10] = addr->s6_addr[11] = 0xff;
+	memcpy(&addr->s6_addr[12], &((struct sockaddr_in *)peer)->sin_addr, 4);
+}
 
-	/* listen for incoming connections */
-	if (listen(sd, QLEN) < 0)
-		errexit("error: cannot listen on port %s", port);
+/* the IPv4 address the caps count the peer under, other IPv6 ones folded
+   into 32 bits, which like a slot collision only makes a cap stricter */
+in_addr_t peerkey(struct sockaddr_storage *peer)
+{
+	struct in6_addr a;
+	uint32_t w[4];
+
+	peer6(peer, &a);
+	memcpy(w, a.s6_addr, sizeof(w));
+	if (IN6_IS_ADDR_V4MAPPED(&a))
+		return w[3];
+	return w[0] ^ w[1] ^ w[2] ^ w[3];
+}
 
-	/* accept a connection */
-	addrlen = sizeof(addr);
-	sd2 = accept(sd, &addr, &addrlen);
-	if (sd2 < 0)
-		errexit("error: could not accept connection", NULL);
+/* per client address connection count, addresses share slots by hash so a
+   collision can only make the cap stricter, never looser */
+unsigned int *ipslot(in_addr_t addr)
+{
+	return &ipconns[(ntohl(addr) * 2654435761u) >> 16];
 }
 
-void sendheader(char *message)
+int ipadmit(in_addr_t addr)
 {
-	memset(responsehead, 0x0, BUFFLEN);
-	memcpy(responsehead, message, strlen(message));
-	if (write(sd2, responsehead, strlen(message)) < 0)
-		errexit("error: could not write to socket", NULL);
+	if (perip_max == 0)
+		return 1;
+	if (__atomic_add_fetch(ipslot(addr), 1, __ATOMIC_RELAXED) <= perip_max)
+		return 1;
+	__atomic_sub_fetch(ipslot(addr), 1, __ATOMIC_RELAXED);
+	return 0;
 }
 
-void sendfile(char *filepath)
+void ipleave(in_addr_t addr)
 {
-	int bytes;
-	char filebuffer[BUFFLEN];
-	FILE *file;
-	if ((file = fopen(filepath, "r+")) == NULL)
+	if (perip_max != 0)
+		__atomic_sub_fetch(ipslot(addr), 1, __ATOMIC_RELAXED);
+}
+
+int addsegment(struct conn *c, const char *data, int fd, off_t off, off_t len)
+{
+	if (c->nsegs == SEGMAX)
+		return ERROR;
+	c->segs[c->nsegs].data = data;
+	c->segs[c->nsegs].fd = fd;
+	c->segs[c->nsegs].off = off;
+	c->segs[c->nsegs].len = len;
+	c->nsegs++;
+	return SUCCESS;
+}
+
+/* queue header text, pump() writes it once the whole response is queued */
+int sendheader(struct conn *c, char *message)
+{
+	size_t len = strlen(message);
+	struct segment *last = (c->nsegs > 0) ? &c->segs[c->nsegs - 1] : NULL;
+
+	if (c->outlen + len > OUTLEN)
+		return ERROR;
+	/* the first thing queued is the status line */
+	if (c->status == 0 && strncmp(message, "HTTP/1.1 ", 9) == 0)
+		c->status = atoi(message + 9);
+	memcpy(c->out + c->outlen, message, len);
+	/* consecutive header text goes out in one write */
+	if (last != NULL && last->data == c->out && last->off + last->len == c->outlen)
+		last->len += len;
+	else if (addsegment(c, c->out, -1, c->outlen, len) != SUCCESS)
+		return ERROR;
+	c->outlen += len;
+	return SUCCESS;
+}
+
+/* a response without a body */
+int sendstatus(struct conn *c, char *status)
+{
+	if (sendheader(c, status) != SUCCESS)
+		return ERROR;
+	return sendheader(c, c->keepalive ? "Content-Length: 0\r\nConnection: keep-alive\r\n\r\n" : "Content-Length: 0\r\nConnection: close\r\n\r\n");
+}
+
+/* queue bytes [first, last] of the body, files go out through sendfile(2)
+   without being staged in user space */
+int sendrange(struct conn *c, struct body *b, off_t first, off_t last)
+{
+	return addsegment(c, b->data, b->fd, first, last - first + 1);
+}
+
+/* write as much of the queued response as the socket takes without blocking,
+   yielding after SENDCHUNK bytes so one big file cannot starve the other connections */
+int pump(struct conn *c)
+{
+	size_t budget = SENDCHUNK;
+	ssize_t bytes;
+
+	while (c->seg < c->nsegs)
 	{
-		sendheader(NOTFND);
-		return;
+		struct segment *s = &c->segs[c->seg];
+		size_t want = (s->len > budget) ? budget : s->len;
+
+		if (s->len == 0)
+		{
+			c->seg++;
+			continue;
+		}
+		if (budget == 0)
+			return PUMP_MORE;
+		/* headers wait for the body that follows them rather than going out alone */
+		if (s->data != NULL)
+			bytes = send(c->sd, s->data + s->off, want, (c->seg + 1 < c->nsegs) ? MSG_MORE : 0);
+		else
+			bytes = sendfile(c->sd, s->fd, &s->off, want);
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return PUMP_MORE;
+		/* the client went away, not fatal for the server */
+		if (bytes <= 0)
+			return PUMP_ERROR;
+		if (s->data != NULL)
+			s->off += bytes;
+		s->len -= bytes;
+		c->sent += bytes;
+		budget -= bytes;
 	}
+	return PUMP_DONE;
+}
+
+/* strong validators for a file: ETag from inode, size and mtime, Last-Modified from mtime
+   each encoding of a file is a different representation, so gets its own ETag */
+void makevalidators(struct body *b, char *etag, size_t etaglen, char *lastmod, size_t lastmodlen)
+{
+	struct tm tm;
 
-	sendheader(OK);
-	while ((bytes = fread(filebuffer, 1, BUFFLEN, file)) > 0)
+	snprintf(etag, etaglen, "\"%lx-%lx-%lx%s\"", (unsigned long)b->st->st_ino, (unsigned long)b->st->st_size,
+			 (unsigned long)b->st->st_mtime, (b->encoding != NULL) ? "-gz" : "");
+	gmtime_r(&b->st->st_mtime, &tm);
+	strftime(lastmod, lastmodlen, HTTPDATE, &tm);
+}
+
+/* Range only applies when If-Range is absent or still names this version of the file */
+int ifrangematches(struct conn *c, char *etag, char *lastmod)
+{
+	struct header *h = findheader(&c->parser, c->buf, "If-Range");
+
+	if (h == NULL)
+		return 1;
+	return (spaneq(c->buf, h->value, etag) || spaneq(c->buf, h->value, lastmod));
+}
+
+/* a conditional GET for the version the client already has, If-None-Match
+   overrides If-Modified-Since when both are sent (RFC 9110 13.2.2) */
+int notmodified(struct conn *c, struct body *b, char *etag)
+{
+	struct header *h = findheader(&c->parser, c->buf, "If-None-Match");
+	const char *s, *end, *tag;
+	struct tm tm;
+
+	if (h != NULL)
 	{
-		write(sd2, filebuffer, bytes);
+		s = c->buf + h->value.off;
+		end = s + h->value.len;
+		while (s < end)
+		{
+			while (s < end && (*s == ' ' || *s == ','))
+				s++;
+			/* the weak comparison, W/ makes no difference */
+			if (end - s > 2 && s[0] == 'W' && s[1] == '/')
+				s += 2;
+			tag = s;
+			while (s < end && *s != ',' && *s != ' ')
+				s++;
+			if ((s - tag == 1 && *tag == '*') || ((size_t)(s - tag) == strlen(etag) && strncmp(tag, etag, s - tag) == 0))
+				return 1;
+		}
+		return 0;
 	}
-	fclose(file);
+	if ((h = findheader(&c->parser, c->buf, "If-Modified-Since")) == NULL || h->value.len >= 64)
+		return 0;
+	char date[64];
+	memcpy(date, c->buf + h->value.off, h->value.len);
+	date[h->value.len] = '\0';
+	memset(&tm, 0, sizeof(tm));
+	if (strptime(date, HTTPDATE, &tm) == NULL)
+		return 0;
+	return b->st->st_mtime <= timegm(&tm);
+}
+
+int partheader(char *buf, size_t len, struct byterange *r, off_t size)
+{
+	return snprintf(buf, len, "\r\n--" BOUNDARY "\r\nContent-Type: application/octet-stream\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+					(long long)r->first, (long long)r->last, (long long)size);
 }
 
-int checkcrlf(char *buffer)
+/* multipart/byteranges body, Content-Length is worked out up front */
+int sendmultipart(struct conn *c, struct body *b, struct byterange *ranges, int nranges, char validators[BUFFLEN / 4])
 {
-	char buffercopy[BUFFLEN];
-	memset(buffercopy, 0x0, BUFFLEN);
-	strcpy(buffercopy, buffer);
+	char head[BUFFLEN];
+	long long total = strlen("\r\n--" BOUNDARY "--\r\n");
+
+	for (int i = 0; i < nranges; i++)
+		total += partheader(NULL, 0, &ranges[i], b->size) + (ranges[i].last - ranges[i].first + 1);
+
+	snprintf(head, BUFFLEN, PARTIAL "Content-Type: multipart/byteranges; boundary=" BOUNDARY "\r\nContent-Length: %lld\r\n%s\r\n",
+			 total, validators);
+	if (sendheader(c, head) != SUCCESS)
+		return ERROR;
 
-	char *line = strtok(buffercopy, "\n");
-	while (line != NULL)
+	for (int i = 0; i < nranges; i++)
 	{
-		if (strcmp((line + strlen(line) - 1), "\r") != 0)
+		partheader(head, BUFFLEN, &ranges[i], b->size);
+		if (sendheader(c, head) != SUCCESS || sendrange(c, b, ranges[i].first, ranges[i].last) != SUCCESS)
 			return ERROR;
-		line = strtok(NULL, "\n");
 	}
-
-	return SUCCESS;
+	return sendheader(c, "\r\n--" BOUNDARY "--\r\n");
 }
 
-int validaterequest(char *buffer, int length)
+int servefile(struct conn *c, struct body *b)
 {
-	char buffercopy[BUFFLEN];
-	memset(buffercopy, 0x0, BUFFLEN);
-	strcpy(buffercopy, buffer);
+	char head[BUFFLEN], validators[BUFFLEN / 4], etag[64], lastmod[64];
+	struct byterange ranges[RANGEMAX];
+	struct header *h;
+	int nranges = -1;
 
-	/* check METHOD ARGUMENT HTTP/VERSION\r\n */
-	request.method = strtok(buffercopy, " ");
-	request.arg = strtok(NULL, " ");
-	request.protocol = strtok(NULL, " ");
-	if (request.method == NULL || request.arg == NULL || request.protocol == NULL)
-		return ERROR;
+	makevalidators(b, etag, sizeof(etag), lastmod, sizeof(lastmod));
+	snprintf(validators, sizeof(validators), "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\nVary: Accept-Encoding\r\n%s%s%s%s",
+			 etag, lastmod, (b->encoding != NULL) ? "Content-Encoding: " : "", (b->encoding != NULL) ? b->encoding : "",
+			 (b->encoding != NULL) ? "\r\n" : "", CONNHDR(c));
 
-	/* find first line end, check if correct ('\r\n$') or not (' .*$') */
-	int eolspan = strcspn(request.protocol, "\r ");
-	if (strncmp((request.protocol + eolspan) + 1, "\n", 1) != 0)
-		return ERROR;
+	if (notmodified(c, b, etag))
+	{
+		snprintf(head, BUFFLEN, NOTMOD "%s\r\n", validators);
+		return sendheader(c, head);
+	}
 
-	/* check all lines end with \r\n */
-	/* assuming a line is a string ending in \n */
-	if (checkcrlf(buffer) != SUCCESS)
+	h = findheader(&c->parser, c->buf, "Range");
+	if (h != NULL && ifrangematches(c, etag, lastmod))
+		nranges = parseranges(c->buf + h->value.off, h->value.len, b->size, ranges, RANGEMAX);
+
+	if (nranges == 0)
+	{
+		snprintf(head, BUFFLEN, BADRANGE "Content-Range: bytes */%lld\r\nContent-Length: 0\r\n%s\r\n", (long long)b->size, validators);
+		return sendheader(c, head);
+	}
+	else if (nranges == 1)
+	{
+		snprintf(head, BUFFLEN, PARTIAL "Content-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\n%s\r\n",
+				 (long long)ranges[0].first, (long long)ranges[0].last, (long long)b->size,
+				 (long long)(ranges[0].last - ranges[0].first + 1), validators);
+		if (sendheader(c, head) != SUCCESS)
+			return ERROR;
+		return sendrange(c, b, ranges[0].first, ranges[0].last);
+	}
+	else if (nranges > 1)
+		return sendmultipart(c, b, ranges, nranges, validators);
+
+	snprintf(head, BUFFLEN, OK "Content-Length: %lld\r\n%s\r\n", (long long)b->size, validators);
+	if (sendheader(c, head) != SUCCESS)
 		return ERROR;
-	/* if header somehow over 1024B */
-	if (length == BUFFLEN)
+	if (b->size == 0)
+		return SUCCESS;
+	return sendrange(c, b, 0, b->size - 1);
+}
+
+/* true if Accept-Encoding lists gzip (or *) without q=0 */
+int acceptsgzip(struct conn *c)
+{
+	struct header *h = findheader(&c->parser, c->buf, "Accept-Encoding");
+	const char *s, *end, *tok;
+	int toklen, weighted;
+
+	if (h == NULL)
+		return 0;
+	s = c->buf + h->value.off;
+	end = s + h->value.len;
+	while (s < end)
 	{
-		do
+		while (s < end && (*s == ' ' || *s == ','))
+			s++;
+		tok = s;
+		while (s < end && *s != ',' && *s != ';' && *s != ' ')
+			s++;
+		toklen = s - tok;
+
+		/* any nonzero digit in the parameters means q > 0 */
+		weighted = 1;
+		for (; s < end && *s != ','; s++)
 		{
-			length = read(sd2, buffer, BUFFLEN);
-			if (checkcrlf(buffer) != SUCCESS)
-				return ERROR;
-		} while (length == BUFFLEN);
+			if (*s == '=' && s[-1] == 'q')
+				weighted = 0;
+			else if (!weighted && *s >= '1' && *s <= '9')
+				weighted = 1;
+		}
+
+		if (weighted && ((toklen == 4 && strncasecmp(tok, "gzip", 4) == 0) || (toklen == 6 && strncasecmp(tok, "x-gzip", 6) == 0) ||
+						 (toklen == 1 && *tok == '*')))
+			return 1;
 	}
+	return 0;
+}
 
-	/* check final chars are \r\n\r\n */
-	/* since lines (1, n) can be ignored, dont check if any \r\n\r\n before the end of the header */
-	if (strcmp((buffer + length) - 4, HEADEND) != 0)
-		return ERROR;
+/* switch the body to a gzip representation when one is available
+   a precompressed sibling file wins, otherwise the file is compressed into
+   the cache in the background after its first request, which goes out as it is */
+void choosegzip(struct conn *c, const char *path, unsigned int len, struct body *b)
+{
+	char gzpath[PATH_MAX];
+	struct pathentry *e;
+	struct gzentry *g;
 
-	return SUCCESS;
+	if (len + 3 < sizeof(gzpath))
+	{
+		memcpy(gzpath, path, len);
+		memcpy(gzpath + len, ".gz", 3);
+		/* a sibling older than the file it encodes is stale
+		   a missing one is cached too, so most files cost nothing extra here */
+		e = pathopen(&c->w->paths, gzpath, len + 3, now());
+		if (e != NULL && e->fd >= 0 && S_ISREG(e->st.st_mode) && e->st.st_mtime >= b->st->st_mtime)
+		{
+			b->fd = e->fd;
+			b->size = e->st.st_size;
+			b->st = &e->st;
+			b->encoding = "gzip";
+			c->gzfile = e;
+			return;
+		}
+		if (e != NULL)
+			pathrelease(e);
+	}
+
+	g = gzlookup(b->fd, b->st);
+	if (g != NULL && g->data != NULL)
+	{
+		b->data = g->data;
+		b->size = g->len;
+		b->encoding = "gzip";
+		b->gz = g;
+	}
+	else if (g != NULL)
+		gzrelease(g);
 }
 
-int get()
+/* value of name=value in the target's query string */
+int queryparam(struct conn *c, char *name, struct span *value)
 {
+	char *s = memchr(c->buf + c->parser.target.off, '?', c->parser.target.len);
+	char *end = c->buf + c->parser.target.off + c->parser.target.len;
+	size_t namelen = strlen(name);
+
+	while (s != NULL && s < end)
+	{
+		char *param = s + 1;
+		s = memchr(param, '&', end - param);
+		char *paramend = (s != NULL) ? s : end;
+		if (paramend - param > namelen && strncmp(param, name, namelen) == 0 && param[namelen] == '=')
+		{
+			value->off = param + namelen + 1 - c->buf;
+			value->len = paramend - (param + namelen + 1);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int isstats(struct conn *c)
+{
+	struct span target = c->parser.target;
+
+	return (target.len >= strlen(STATSPATH) && strncmp(c->buf + target.off, STATSPATH, strlen(STATSPATH)) == 0 &&
+			(target.len == strlen(STATSPATH) || c->buf[target.off + strlen(STATSPATH)] == '?'));
+}
+
+/* GET /_stats?token=T[&format=json], the token can also come as Authorization: Bearer T */
+int stats(struct conn *c)
+{
+	char head[BUFFLEN];
+	struct span token, format;
+	struct header *h = findheader(&c->parser, c->buf, "Authorization");
+	int authorized = 0, json = 0, len;
+
+	if (queryparam(c, "token", &token))
+		authorized = spaneq(c->buf, token, auth_token);
+	else if (h != NULL && h->value.len > 7 && strncasecmp(c->buf + h->value.off, "Bearer ", 7) == 0)
+	{
+		token.off = h->value.off + 7;
+		token.len = h->value.len - 7;
+		authorized = spaneq(c->buf, token, auth_token);
+	}
+	if (!authorized)
+		return sendstatus(c, FORBDN);
+
+	if (queryparam(c, "format", &format))
+		json = spaneq(c->buf, format, "json");
+	else if ((h = findheader(&c->parser, c->buf, "Accept")) != NULL)
+		json = (memmem(c->buf + h->value.off, h->value.len, "application/json", 16) != NULL);
+
+	/* the body outlives this call, it is freed once sent */
+	if ((c->extra = malloc(STATSLEN)) == NULL || (len = formatmetrics(c->extra, STATSLEN, json)) < 0)
+		return sendstatus(c, NOTFND);
+	snprintf(head, BUFFLEN, OK "Content-Type: %s\r\nContent-Length: %d\r\nCache-Control: no-store\r\n%s\r\n",
+			 json ? "application/json" : "text/plain; version=0.0.4", len, CONNHDR(c));
+	if (sendheader(c, head) != SUCCESS)
+		return ERROR;
+	return addsegment(c, c->extra, -1, 0, len);
+}
+
+int get(struct conn *c)
+{
+	struct span target = c->parser.target;
+	const char *path = c->buf + target.off;
+	unsigned int len = target.len;
+	struct pathentry *e;
+	struct body b;
+	int escaped;
+
 	/* filename does not start with '/' */
-	if (strncmp(request.arg, "/", 1) != 0)
+	if (c->buf[target.off] != '/')
 	{
-		sendheader(BADFILE);
+		sendstatus(c, BADFILE);
 		return ERROR;
 	}
+	/* server statistics, not a file */
+	else if (isstats(c))
+		return stats(c);
 	/* filename is only '/'*/
-	else if (strcmp(request.arg, "/") == 0)
-		request.arg = "/index.html";
+	else if (target.len == 1)
+	{
+		path = "index.html";
+		len = strlen(path);
+	}
 
-	char *filepath;
-	filepath = strcat(directory, request.arg);
-	int exists = access(filepath, R_OK);
-	if (exists < 0)
+	/* resolved relative to the root directory and never outside it */
+	while (len > 0 && *path == '/')
 	{
-		sendheader(NOTFND);
+		path++;
+		len--;
+	}
+	e = pathopen(&c->w->paths, path, len, now());
+	if (e == NULL || e->fd < 0 || !S_ISREG(e->st.st_mode))
+	{
+		/* ".." or a symlink tried to leave the root */
+		escaped = (e != NULL && (e->err == EXDEV || e->err == ELOOP));
+		if (e != NULL)
+			pathrelease(e);
+		sendstatus(c, escaped ? FORBDN : NOTFND);
 		return ERROR;
 	}
 
-	sendfile(filepath);
-	return SUCCESS;
+	b.fd = e->fd;
+	b.data = NULL;
+	b.size = e->st.st_size;
+	b.st = &e->st;
+	b.encoding = NULL;
+	b.gz = NULL;
+	/* the queued segments read from these until endresponse() */
+	c->file = e;
+	if (acceptsgzip(c))
+		choosegzip(c, path, len, &b);
+	c->gz = b.gz;
+	return servefile(c, &b);
 }
 
-int killserver()
+/* stop accepting, workers finish the requests they are on and exit
+   the listening socket itself is left alone since a new server may share it */
+void stopserver()
 {
-	if (strcmp(request.arg, auth_token) == 0)
+	alive = 0;
+	if (write(wakefd[1], "x", 1) < 0)
+		errexit("error: cannot wake workers", NULL);
+}
+
+int killserver(struct conn *c)
+{
+	if (spaneq(c->buf, c->parser.target, auth_token))
 	{
-		alive = 0;
-		close(sd);
+		stopserver();
 		return SUCCESS;
 	}
 	else
 		return ERROR;
 }
 
-void runrequest()
+void runrequest(struct conn *c)
 {
-	request.method = strtok(request.method, " ");
-	request.arg = strtok(request.arg, " ");
-	if (strcmp(request.method, "GET") == 0)
+	if (c->method == M_GET)
 	{
-		get();
+		get(c);
 	}
-	else if (strcmp(request.method, "SHUTDOWN") == 0)
+	else if (c->method == M_SHUTDOWN)
 	{
-		if (killserver() == SUCCESS)
-			sendheader(SHUTDN);
+		if (killserver(c) == SUCCESS)
+		{
+			c->keepalive = 0;
+			sendstatus(c, SHUTDN);
+		}
 		else
-			sendheader(FORBDN);
+			sendstatus(c, FORBDN);
 	}
 	else
 	{
-		sendheader(UNSUPD);
+		sendstatus(c, UNSUPD);
 	}
 }
 
-void readrequest()
+/* HTTP/1.1 connections persist unless the client says close, HTTP/1.0 ones
+   only when the client asks for keep-alive */
+int wantskeepalive(struct conn *c)
 {
-	int bytes;
-	char buffer[BUFFLEN];
-	memset(buffer, 0x0, BUFFLEN);
+	struct header *h = findheader(&c->parser, c->buf, "Connection");
 
-	bytes = read(sd2, buffer, BUFFLEN);
-	if (bytes < 0)
-		errexit("error: cannot read from connection", NULL);
+	if (!alive || idle_wait == 0)
+		return 0;
+	if (h != NULL && spancaseeq(c->buf, h->value, "close"))
+		return 0;
+	if (h != NULL && spancaseeq(c->buf, h->value, "keep-alive"))
+		return 1;
+	return spaneq(c->buf, c->parser.version, "HTTP/1.1");
+}
 
-	/* handle anything that can return 400 */
-	if (validaterequest(buffer, bytes) != SUCCESS)
+/* the parser is finished with the header, queue the response to it */
+void readrequest(struct conn *c, int status)
+{
+	if (spaneq(c->buf, c->parser.method, "GET"))
+		c->method = M_GET;
+	else if (spaneq(c->buf, c->parser.method, "SHUTDOWN"))
+		c->method = M_SHUTDOWN;
+
+	/* handle anything that can return 400, including oversized headers
+	   we cannot tell where the next request would start, so close after */
+	if (status != PARSE_DONE)
 	{
-		sendheader(BADREQ);
+		c->keepalive = 0;
+		sendstatus(c, BADREQ);
 		return;
 	}
 
 	/* handle 501 */
-	if (strncmp(request.protocol, "HTTP/", 5) != 0)
+	if (c->parser.version.len < 5 || strncmp(c->buf + c->parser.version.off, "HTTP/", 5) != 0)
+	{
+		c->keepalive = 0;
+		sendstatus(c, NOTIMPL);
+		return;
+	}
+
+	c->keepalive = wantskeepalive(c);
+	runrequest(c);
+}
+
+/* queue an access log record, dropped and counted rather than waiting if the ring is full */
+void logrequest(struct conn *c, long long usecs)
+{
+	struct logrec r;
+	unsigned int linelen = 0;
+
+	clock_gettime(CLOCK_REALTIME, &r.when);
+	peer6(&c->peer, &r.addr);
+	r.status = c->status;
+	r.bytes = c->sent;
+	r.usecs = usecs;
+	/* the request line runs from the method to the end of the version,
+	   for a malformed request log whatever came before the first line break */
+	if (c->parser.version.len > 0)
+		linelen = c->parser.version.off + c->parser.version.len - c->parser.method.off;
+	else
 	{
-		sendheader(NOTIMPL);
+		while (linelen < c->len && c->buf[linelen] != '\r' && c->buf[linelen] != '\n')
+			linelen++;
+		c->parser.method.off = 0;
+	}
+	r.linelen = (linelen > LOGLINE) ? LOGLINE : linelen;
+	memcpy(r.line, c->buf + c->parser.method.off, r.linelen);
+	/* keep the auth token out of the log */
+	if (c->parser.version.len > 0 && (isstats(c) || c->method == M_SHUTDOWN))
+		r.linelen = snprintf(r.line, LOGLINE, "%.*s %s %.*s", c->parser.method.len, c->buf + c->parser.method.off,
+							 (c->method == M_SHUTDOWN) ? "-" : STATSPATH, c->parser.version.len, c->buf + c->parser.version.off);
+	if (logpush(c->thread, &r) < 0)
+		countlogdrop(c->metrics);
+}
+
+/* count and log the request once its response is over, sent whole or not */
+void finishrequest(struct conn *c)
+{
+	long long usecs;
+
+	if (c->status == 0)
 		return;
+	usecs = (now() - c->start) / 1000;
+	countrequest(c->metrics, c->method, c->status, c->sent, usecs);
+	if (log_path != NULL)
+		logrequest(c, usecs);
+}
+
+/* let go of everything the queued response refers to */
+void endresponse(struct conn *c)
+{
+	if (c->gz != NULL)
+		gzrelease(c->gz);
+	if (c->gzfile != NULL)
+		pathrelease(c->gzfile);
+	if (c->file != NULL)
+		pathrelease(c->file);
+	free(c->extra);
+	c->gz = NULL;
+	c->file = c->gzfile = NULL;
+	c->extra = NULL;
+	c->outlen = 0;
+	c->nsegs = c->seg = 0;
+}
+
+/* get ready for the next request, keeping any pipelined bytes after this one */
+void nextrequest(struct conn *c)
+{
+	unsigned int used = (c->parser.headerlen < c->len) ? c->parser.headerlen : c->len;
+
+	memmove(c->buf, c->buf + used, c->len - used);
+	c->len -= used;
+	parserinit(&c->parser, header_limit);
+	c->method = M_OTHER;
+	c->status = 0;
+	c->sent = 0;
+	c->keepalive = 0;
+	if (c->len > 0)
+	{
+		c->state = CS_READ;
+		c->start = now();
+		timerset(&c->w->wheel, &c->timer, deadline(header_wait));
 	}
+	else
+	{
+		c->state = CS_IDLE;
+		timerset(&c->w->wheel, &c->timer, deadline(idle_wait));
+	}
+}
+
+void watch(struct conn *c, unsigned int events)
+{
+	struct epoll_event ev;
+
+	if (c->events == events)
+		return;
+	ev.events = events;
+	ev.data.ptr = c;
+	epoll_ctl(c->w->ep, EPOLL_CTL_MOD, c->sd, &ev);
+	c->events = events;
+}
+
+/* a zeroed sqe, submitting what is queued first if the ring is full */
+struct io_uring_sqe *getsqe(struct worker *w)
+{
+	struct io_uring_sqe *sqe;
+
+	while ((sqe = uringsqe(&w->ring)) == NULL)
+		uringsubmit(&w->ring, 0);
+	return sqe;
+}
+
+/* cancel every request on the connection's socket, their completions come back as errors */
+void ucancel(struct conn *c)
+{
+	struct io_uring_sqe *sqe = getsqe(c->w);
 
-	runrequest();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = c->sd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = 0;
 }
 
-void closesocket()
+void releasestage(struct conn *c)
 {
-	close(sd2);
+	c->w->freestages[c->w->nfree++] = c->stage;
+	c->stage = -1;
+	c->staged = c->stagesent = 0;
+}
+
+void unwait(struct conn *c)
+{
+	struct worker *w = c->w;
+	struct conn **p = &w->waithead, *prev = NULL;
+
+	while (*p != c)
+	{
+		prev = *p;
+		p = &(*p)->waitnext;
+	}
+	*p = c->waitnext;
+	if (w->waittail == c)
+		w->waittail = prev;
+	c->waiting = 0;
+}
+
+/* close and hand c to the worker to free once no event in this batch can name it */
+void closeconn(struct conn *c)
+{
+	struct worker *w = c->w;
+
+	/* io_uring still has requests on the socket: cancel them and
+	   finish closing when the last one completes */
+	if (c->inflight > 0)
+	{
+		if (!c->closing)
+		{
+			c->closing = 1;
+			timerclear(&w->wheel, &c->timer);
+			shutdown(c->sd, SHUT_RDWR);
+			ucancel(c);
+		}
+		return;
+	}
+	if (c->waiting)
+		unwait(c);
+	if (c->stage >= 0)
+		releasestage(c);
+	endresponse(c);
+	timerclear(&w->wheel, &c->timer);
+	close(c->sd);
+	ipleave(peerkey(&c->peer));
+	countconn(c->metrics, -1);
+	c->state = CS_CLOSED;
+
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		w->conns = c->next;
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+	c->next = w->dead;
+	w->dead = c;
+}
+
+/* move c along as far as it can go without blocking */
+void advance(struct conn *c)
+{
+	int status, bytes;
+
+	while (c->state != CS_CLOSED)
+	{
+		if (c->state == CS_SEND)
+		{
+			status = pump(c);
+			if (status == PUMP_MORE)
+			{
+				/* the deadline is for making progress, not for the whole body */
+				timerset(&c->w->wheel, &c->timer, deadline(send_wait));
+				watch(c, EPOLLOUT);
+				return;
+			}
+			finishrequest(c);
+			endresponse(c);
+			if (status == PUMP_ERROR || !c->keepalive)
+				closeconn(c);
+			else
+				nextrequest(c);
+			continue;
+		}
+
+		/* a pipelined request may already be buffered */
+		status = (c->len > 0) ? parserequest(&c->parser, c->buf, c->len) : PARSE_MORE;
+		if (status != PARSE_MORE)
+		{
+			readrequest(c, status);
+			c->state = CS_SEND;
+			continue;
+		}
+
+		bytes = read(c->sd, c->buf + c->len, header_limit - c->len);
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			watch(c, EPOLLIN);
+			return;
+		}
+		if (bytes <= 0)
+		{
+			/* client gave up partway through */
+			if (bytes == 0 && c->len > 0)
+			{
+				c->keepalive = 0;
+				sendstatus(c, BADREQ);
+				c->state = CS_SEND;
+				continue;
+			}
+			closeconn(c);
+			return;
+		}
+		if (c->len == 0)
+			c->start = now();
+		/* the header deadline runs from the first byte and is not pushed back
+		   by later ones, so trickling a header in a byte at a time does not help */
+		if (c->state == CS_IDLE)
+		{
+			c->state = CS_READ;
+			timerset(&c->w->wheel, &c->timer, deadline(header_wait));
+		}
+		c->len += bytes;
+	}
+}
+
+/* a connection missed its deadline */
+void expire(struct timer *t)
+{
+	struct conn *c = t->data;
+
+	if (c->state == CS_SEND)
+		finishrequest(c);
+	closeconn(c);
+}
+
+/* a conn from the worker's pool, growing it by a slab when it is empty
+   slabs are never freed, a worker keeps enough conns for its busiest moment */
+struct conn *conntake(struct worker *w)
+{
+	size_t size = (sizeof(struct conn) + header_limit + 63) & ~(size_t)63;
+	struct conn *c;
+	char *slab;
+
+	if (w->spare == NULL)
+	{
+		if (posix_memalign((void **)&slab, 64, CONNSLAB * size) != 0)
+			return NULL;
+		for (int i = 0; i < CONNSLAB; i++)
+		{
+			c = (struct conn *)(slab + i * size);
+			c->next = w->spare;
+			w->spare = c;
+		}
+	}
+	c = w->spare;
+	w->spare = c->next;
+	return c;
+}
+
+/* hand back the conns closed during this batch of events */
+void bury(struct worker *w)
+{
+	struct conn *c;
+
+	while ((c = w->dead) != NULL)
+	{
+		w->dead = c->next;
+		c->next = w->spare;
+		w->spare = c;
+	}
+}
+
+/* set up a connection that has passed the address cap, NULL if it could not be */
+struct conn *newconn(struct worker *w, int csd, struct sockaddr_storage *peer)
+{
+	struct conn *c = conntake(w);
+	int one = 1;
+
+	if (c == NULL)
+	{
+		close(csd);
+		ipleave(peerkey(peer));
+		countdrop(w->metrics);
+		return NULL;
+	}
+	/* responses are queued whole, so nothing is gained by Nagle holding back
+	   the tail of one while a kept-alive client waits for it */
+	setsockopt(csd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	c->sd = csd;
+	c->peer = *peer;
+	c->w = w;
+	c->thread = w->id;
+	c->metrics = w->metrics;
+	c->len = 0;
+	parserinit(&c->parser, header_limit);
+	c->file = c->gzfile = NULL;
+	c->gz = NULL;
+	c->extra = NULL;
+	c->outlen = 0;
+	c->nsegs = c->seg = 0;
+	c->inflight = c->closing = c->waiting = 0;
+	c->step = STEP_NONE;
+	c->stage = -1;
+	c->staged = c->stagesent = 0;
+	timerinit(&c->timer, c);
+
+	c->prev = NULL;
+	c->next = w->conns;
+	if (w->conns != NULL)
+		w->conns->prev = c;
+	w->conns = c;
+	countconn(c->metrics, 1);
+
+	/* a new connection gets the header deadline straight away,
+	   opening sockets and sending nothing is the cheapest attack */
+	nextrequest(c);
+	c->state = CS_READ;
+	c->start = now();
+	timerset(&w->wheel, &c->timer, deadline(header_wait));
+	return c;
+}
+
+void startconn(struct worker *w, int csd, struct sockaddr_storage *peer)
+{
+	struct conn *c = newconn(w, csd, peer);
+	struct epoll_event ev;
+
+	if (c == NULL)
+		return;
+	ev.events = c->events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(w->ep, EPOLL_CTL_ADD, csd, &ev) < 0)
+	{
+		closeconn(c);
+		return;
+	}
+	advance(c);
+}
+
+void acceptconns(struct worker *w)
+{
+	struct sockaddr_storage peer;
+	unsigned int addrlen;
+	int csd;
+
+	for (int i = 0; i < ACCEPTBATCH; i++)
+	{
+		addrlen = sizeof(peer);
+		csd = accept4(sd, (struct sockaddr *)&peer, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (csd < 0)
+		{
+			/* another worker took it, or a half-open connection was reset */
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			/* out of descriptors or memory: the connection waits or is lost */
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+			{
+				countdrop(w->metrics);
+				return;
+			}
+			errexit("error: could not accept connection", NULL);
+		}
+		/* past the per address cap: say so if the socket takes it, then hang up */
+		if (!ipadmit(peerkey(&peer)))
+		{
+			if (write(csd, TOOMANY, strlen(TOOMANY)) < 0)
+				errno = 0;
+			close(csd);
+			countdrop(w->metrics);
+			continue;
+		}
+		startconn(w, csd, &peer);
+	}
+}
+
+/* the server is stopping: stop accepting and let every connection finish
+   a kept-alive one may already have a request on the wire, so it is not cut off
+   but gets Connection: close on its next response or reaches its idle deadline */
+void drain(struct worker *w)
+{
+	w->draining = 1;
+	if (backend == BACKEND_URING)
+	{
+		struct io_uring_sqe *sqe = getsqe(w);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (unsigned long)&listener;
+		sqe->user_data = 0;
+	}
+	else
+	{
+		epoll_ctl(w->ep, EPOLL_CTL_DEL, sd, NULL);
+		epoll_ctl(w->ep, EPOLL_CTL_DEL, wakefd[0], NULL);
+	}
+}
+
+void hangup(int sig)
+{
+	logreopen();
+}
+
+/* serve hot restarts on control_path until the server stops
+   the replacement gets the listening socket while we keep accepting, and we
+   only stop once it reports that it is accepting too, so no connection is refused */
+void controlloop()
+{
+	int ctl, peer;
+	struct pollfd fds[2];
+
+	if ((ctl = handofflisten(control_path)) < 0)
+		errexit("error: cannot create control socket %s", control_path);
+	fds[0].fd = ctl;
+	fds[0].events = POLLIN;
+	fds[1].fd = wakefd[0];
+	fds[1].events = POLLIN;
+
+	while (alive)
+	{
+		if (poll(fds, 2, -1) < 0 || !(fds[0].revents & POLLIN))
+			continue;
+		if (handoffsend(ctl, sd, &peer) < 0)
+			continue;
+		if (handoffwait(peer, HANDOFF_READY, HANDOFF_WAIT) == 0)
+		{
+			stopserver();
+			/* release the path before telling the new server to bind it */
+			close(ctl);
+			unlink(control_path);
+			ctl = -1;
+			handoffsignal(peer, HANDOFF_DONE);
+		}
+		close(peer);
+	}
+	if (ctl >= 0)
+	{
+		close(ctl);
+		unlink(control_path);
+	}
+}
+
+void usend(struct conn *c, const char *data, unsigned int len, int more, int step)
+{
+	struct io_uring_sqe *sqe = getsqe(c->w);
+
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = c->sd;
+	sqe->addr = (unsigned long)data;
+	sqe->len = len;
+	sqe->msg_flags = more ? MSG_MORE : 0;
+	sqe->user_data = (unsigned long)c | UOP_SEND;
+	c->inflight++;
+	c->step = step;
+	timerset(&c->w->wheel, &c->timer, deadline(send_wait));
+}
+
+/* read the next piece of a file segment into a stage and send it from there,
+   linked so both go to the kernel together and the send starts as soon as the read is done */
+void usendfile(struct conn *c, struct segment *s)
+{
+	struct worker *w = c->w;
+	struct io_uring_sqe *sqe = getsqe(w);
+	unsigned int len = (s->len > STAGELEN) ? STAGELEN : s->len;
+	char *stage = w->stages + (size_t)c->stage * STAGELEN;
+
+	sqe->opcode = w->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = s->fd;
+	sqe->addr = (unsigned long)stage;
+	sqe->len = len;
+	sqe->off = s->off;
+	sqe->buf_index = 0;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = (unsigned long)c | UOP_READ;
+	c->inflight++;
+	usend(c, stage, len, s->len > len || c->seg + 1 < c->nsegs, STEP_FILE);
+}
+
+void urecv(struct conn *c)
+{
+	struct io_uring_sqe *sqe = getsqe(c->w);
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = c->sd;
+	sqe->addr = (unsigned long)(c->buf + c->len);
+	sqe->len = header_limit - c->len;
+	sqe->user_data = (unsigned long)c | UOP_RECV;
+	c->inflight++;
+	c->step = STEP_RECV;
+}
+
+/* the io_uring counterpart of advance(): take in what the last step did,
+   then queue the next step, everything between is shared with the epoll loop */
+void uadvance(struct conn *c)
+{
+	struct worker *w = c->w;
+	struct segment *s = &c->segs[c->seg];
+	int step = c->step, status;
+
+	c->step = STEP_NONE;
+	if (step == STEP_RECV)
+	{
+		if (c->readres == 0 && c->len > 0)
+		{
+			/* client gave up partway through */
+			c->keepalive = 0;
+			sendstatus(c, BADREQ);
+			c->state = CS_SEND;
+		}
+		else if (c->readres <= 0)
+		{
+			closeconn(c);
+			return;
+		}
+		else
+		{
+			if (c->len == 0)
+				c->start = now();
+			/* same rule as advance(), the header deadline runs from the first byte */
+			if (c->state == CS_IDLE)
+			{
+				c->state = CS_READ;
+				timerset(&w->wheel, &c->timer, deadline(header_wait));
+			}
+			c->len += c->readres;
+		}
+	}
+	else if (step == STEP_SEND || step == STEP_STAGE)
+	{
+		if (c->sendres <= 0)
+		{
+			finishrequest(c);
+			closeconn(c);
+			return;
+		}
+		c->sent += c->sendres;
+		if (step == STEP_STAGE)
+			c->stagesent += c->sendres;
+		else
+		{
+			s->off += c->sendres;
+			s->len -= c->sendres;
+		}
+	}
+	else if (step == STEP_FILE)
+	{
+		/* a short read cancels the linked send, what it did read is still in the stage */
+		if (c->readres <= 0 || c->sendres == 0 || (c->sendres < 0 && c->sendres != -ECANCELED))
+		{
+			finishrequest(c);
+			closeconn(c);
+			return;
+		}
+		s->off += c->readres;
+		s->len -= c->readres;
+		c->staged = c->readres;
+		c->stagesent = (c->sendres > 0) ? c->sendres : 0;
+		c->sent += c->stagesent;
+	}
+
+	while (c->state != CS_CLOSED)
+	{
+		if (c->state == CS_SEND)
+		{
+			/* the stage goes out in full before more of the file is read */
+			if (c->stage >= 0 && c->stagesent < c->staged)
+			{
+				usend(c, w->stages + (size_t)c->stage * STAGELEN + c->stagesent, c->staged - c->stagesent, 1, STEP_STAGE);
+				return;
+			}
+			if (c->stage >= 0)
+				releasestage(c);
+			while (c->seg < c->nsegs && c->segs[c->seg].len == 0)
+				c->seg++;
+			if (c->seg < c->nsegs)
+			{
+				s = &c->segs[c->seg];
+				if (s->data != NULL)
+					usend(c, s->data + s->off, (s->len > SENDCHUNK) ? SENDCHUNK : s->len, c->seg + 1 < c->nsegs, STEP_SEND);
+				else if (w->nfree > 0)
+				{
+					c->stage = w->freestages[--w->nfree];
+					usendfile(c, s);
+				}
+				else
+				{
+					/* every stage is busy, uringloop() resumes us when one comes back */
+					c->waitnext = NULL;
+					if (w->waittail != NULL)
+						w->waittail->waitnext = c;
+					else
+						w->waithead = c;
+					w->waittail = c;
+					c->waiting = 1;
+				}
+				return;
+			}
+			finishrequest(c);
+			endresponse(c);
+			if (!c->keepalive)
+			{
+				closeconn(c);
+				return;
+			}
+			nextrequest(c);
+			continue;
+		}
+
+		/* a pipelined request may already be buffered */
+		status = (c->len > 0) ? parserequest(&c->parser, c->buf, c->len) : PARSE_MORE;
+		if (status != PARSE_MORE)
+		{
+			readrequest(c, status);
+			c->state = CS_SEND;
+			continue;
+		}
+		urecv(c);
+		return;
+	}
+}
+
+void ucomplete(struct conn *c, int op, int res)
+{
+	c->inflight--;
+	if (op == UOP_SEND)
+		c->sendres = res;
+	else
+		c->readres = res;
+	if (c->inflight > 0)
+		return;
+	if (c->closing)
+		closeconn(c);
+	else
+		uadvance(c);
+}
+
+/* one multishot accept keeps producing connections until it is cancelled */
+void uaccept(struct worker *w)
+{
+	struct io_uring_sqe *sqe = getsqe(w);
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = sd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = (unsigned long)&listener;
+	w->accepting = 1;
+}
+
+void uaccepted(struct worker *w, int res, unsigned int flags)
+{
+	struct sockaddr_storage peer;
+	unsigned int addrlen = sizeof(peer);
+	struct conn *c;
+
+	/* the kernel ended the multishot, errors and drain()'s cancel do that */
+	if (!(flags & IORING_CQE_F_MORE))
+	{
+		w->accepting = 0;
+		if (!w->draining)
+			uaccept(w);
+	}
+	if (res < 0)
+	{
+		/* out of descriptors or memory: the connection waits or is lost */
+		if (res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM)
+			countdrop(w->metrics);
+		return;
+	}
+	/* multishot accepts share one address buffer, so ask for each peer */
+	if (getpeername(res, (struct sockaddr *)&peer, &addrlen) < 0)
+	{
+		close(res);
+		return;
+	}
+	if (!ipadmit(peerkey(&peer)))
+	{
+		if (write(res, TOOMANY, strlen(TOOMANY)) < 0)
+			errno = 0;
+		close(res);
+		countdrop(w->metrics);
+		return;
+	}
+	if ((c = newconn(w, res, &peer)) != NULL)
+		uadvance(c);
+}
+
+/* the same connection cycle as the epoll loop, but accepts, reads and sends are
+   io_uring requests and a single io_uring_enter both submits and reaps them */
+void uringloop(struct worker *w)
+{
+	struct io_uring_cqe *cqe;
+	struct io_uring_sqe *sqe;
+	struct conn *c;
+	unsigned long tag;
+	unsigned int flags;
+	int res;
+
+	if (uringinit(&w->ring, URINGDEPTH) < 0)
+		errexit("error: cannot set up io_uring", NULL);
+	if (posix_memalign((void **)&w->stages, 4096, (size_t)STAGES * STAGELEN) != 0)
+		errexit("error: cannot allocate staging buffers", NULL);
+	/* pinned once so file reads skip mapping the pages on every request,
+	   plain reads still work if the memlock limit says no */
+	w->fixed = (uringregister(&w->ring, w->stages, (size_t)STAGES * STAGELEN) == 0);
+	for (int i = 0; i < STAGES; i++)
+		w->freestages[i] = i;
+	w->nfree = STAGES;
+	w->waithead = w->waittail = NULL;
+
+	uaccept(w);
+	sqe = getsqe(w);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = wakefd[0];
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = (unsigned long)&waker;
+	if (!alive)
+		drain(w);
+
+	/* connections accepted before the cancel landed still need serving */
+	while (!w->draining || w->conns != NULL || w->accepting)
+	{
+		if (uringsubmit(&w->ring, (w->wheel.pending > 0) ? TICKMS * 1000000LL : -1) < 0)
+			errexit("error: cannot submit to io_uring", NULL);
+		while ((cqe = uringpeek(&w->ring)) != NULL)
+		{
+			tag = cqe->user_data;
+			res = cqe->res;
+			flags = cqe->flags;
+			uringseen(&w->ring);
+			if (tag == (unsigned long)&listener)
+				uaccepted(w, res, flags);
+			else if (tag == (unsigned long)&waker)
+			{
+				if (!w->draining)
+					drain(w);
+			}
+			else if (tag != 0)
+				ucomplete((struct conn *)(tag & ~3UL), tag & 3, res);
+		}
+		wheeladvance(&w->wheel, ticks(), expire);
+
+		/* stages freed in this batch go to whoever waited longest */
+		while (w->nfree > 0 && (c = w->waithead) != NULL)
+		{
+			unwait(c);
+			uadvance(c);
+		}
+		bury(w);
+	}
+	uringfree(&w->ring);
+	free(w->stages);
+}
+
+/* one event loop per thread, every connection it accepts stays on it
+   deadlines live on the thread's timer wheel so idle sockets cost nothing until they expire */
+void *worker(void *arg)
+{
+	struct worker *w = &workers[(long)arg];
+	struct epoll_event ev, events[MAXEVENTS];
+	int n;
+
+	w->id = (long)arg;
+	w->metrics = metricsfor(w->id);
+	w->conns = w->dead = w->spare = NULL;
+	w->draining = 0;
+	wheelinit(&w->wheel, ticks());
+	pathinit(&w->paths, rootfd);
+	if (backend == BACKEND_URING)
+	{
+		uringloop(w);
+		return NULL;
+	}
+
+	if ((w->ep = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		errexit("error: cannot create epoll instance", NULL);
+	/* only one worker is woken per incoming connection */
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.ptr = &listener;
+	if (epoll_ctl(w->ep, EPOLL_CTL_ADD, sd, &ev) < 0)
+		errexit("error: cannot watch listening socket", NULL);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &waker;
+	if (epoll_ctl(w->ep, EPOLL_CTL_ADD, wakefd[0], &ev) < 0)
+		errexit("error: cannot watch wake pipe", NULL);
+	if (!alive)
+		drain(w);
+
+	while (!w->draining || w->conns != NULL)
+	{
+		n = epoll_wait(w->ep, events, MAXEVENTS, (w->wheel.pending > 0) ? TICKMS : -1);
+		for (int i = 0; i < n; i++)
+		{
+			if (events[i].data.ptr == &listener)
+				acceptconns(w);
+			else if (events[i].data.ptr == &waker)
+			{
+				if (!w->draining)
+					drain(w);
+			}
+			else if (((struct conn *)events[i].data.ptr)->state != CS_CLOSED)
+				advance(events[i].data.ptr);
+		}
+		wheeladvance(&w->wheel, ticks(), expire);
+
+		bury(w);
+	}
+	close(w->ep);
+	return NULL;
 }
 
 int main(int argc, char *argv[])
@@ -315,23 +1792,69 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "error: authentication token required\n");
 		usage(argv[0]);
 	}
+	else if (takeover && control_path == NULL)
+	{
+		fprintf(stderr, "error: -R needs the old server's -u socket\n");
+		usage(argv[0]);
+	}
 	else
 	{
-		/* check that directory exists */
-		int exists = access(directory, R_OK);
-		if (exists < 0)
+		/* open the root once, request paths are resolved beneath it */
+		if ((rootfd = pathroot(directory)) < 0)
 			errexit("error: cannot read root directory", NULL);
 
 		portnum = strtoul(port, NULL, 10);
 
-		makesocket();
+		/* a dropped download should only end that connection */
+		signal(SIGPIPE, SIG_IGN);
+		gzinit(gzcache_limit);
+
+		pthread_t threads[MAXWORKERS];
+		if (nworkers == 0)
+			nworkers = (sysconf(_SC_NPROCESSORS_ONLN) > 0) ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+		if (nworkers > MAXWORKERS)
+			nworkers = MAXWORKERS;
+		metricsinit(nworkers);
+		if (log_path != NULL)
+		{
+			if (loginit(log_path, log_rotate, nworkers) < 0)
+				errexit("error: cannot open access log %s", log_path);
+			signal(SIGHUP, hangup);
+		}
+
+		if (pipe(wakefd) < 0)
+			errexit("error: cannot create wake pipe", NULL);
+
+		int peer = -1;
+		if (takeover)
+		{
+			if ((sd = handoffreceive(control_path, &peer)) < 0)
+				errexit("error: cannot take over from server on %s", control_path);
+		}
+		else
+			makesocket();
+
 		alive = 1;
-		while (alive)
+		for (long i = 0; i < nworkers; i++)
+		{
+			if (pthread_create(&threads[i], NULL, worker, (void *)i) != 0)
+				errexit("error: cannot start worker thread", NULL);
+		}
+
+		if (takeover)
 		{
-			listensocket();
-			readrequest();
-			closesocket();
+			/* old server drains and exits once we are accepting */
+			handoffsignal(peer, HANDOFF_READY);
+			handoffwait(peer, HANDOFF_DONE, -1);
+			close(peer);
 		}
+		if (control_path != NULL)
+			controlloop();
+
+		for (int i = 0; i < nworkers; i++)
+			pthread_join(threads[i], NULL);
+		close(sd);
+		logstop();
 	}
 
 	exit(SUCCESS);
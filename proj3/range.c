@@ -0,0 +1,108 @@
+// Ben Smith range.c Range header parsing
+
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include "range.h"
+
+#define UNIT "bytes="
+
+/* read decimal digits at *s, returns -1 if there are none or they overflow */
+static off_t readnum(const char **s, const char *end)
+{
+	off_t n = 0;
+	const char *start = *s;
+
+	while (*s < end && **s >= '0' && **s <= '9')
+	{
+		if (n > (((off_t)1 << 62) - 1) / 10)
+			return -1;
+		n = n * 10 + (**s - '0');
+		(*s)++;
+	}
+	return (*s == start) ? -1 : n;
+}
+
+static void skipspace(const char **s, const char *end)
+{
+	while (*s < end && (**s == ' ' || **s == '\t'))
+		(*s)++;
+}
+
+/* parse a Range header value against a representation of size bytes
+   returns:
+   n > 0 - number of satisfiable ranges stored in ranges, in request order
+   0     - syntactically fine but nothing satisfiable, answer 416
+   -1    - malformed, unknown unit or too many ranges, ignore the header */
+int parseranges(const char *value, unsigned int len, off_t size, struct byterange *ranges, int max)
+{
+	const char *s = value;
+	const char *end = value + len;
+	int specs = 0, n = 0;
+
+	if (len < strlen(UNIT) || strncasecmp(s, UNIT, strlen(UNIT)) != 0)
+		return -1;
+	s += strlen(UNIT);
+
+	while (s < end)
+	{
+		off_t first, last;
+
+		skipspace(&s, end);
+		if (s < end && *s == ',')
+		{
+			/* empty list elements are allowed */
+			s++;
+			continue;
+		}
+		if (s >= end)
+			break;
+		if (++specs > max)
+			return -1;
+
+		if (*s == '-')
+		{
+			/* suffix range: last N bytes */
+			s++;
+			off_t suffix = readnum(&s, end);
+			if (suffix < 0)
+				return -1;
+			first = (suffix >= size) ? 0 : size - suffix;
+			last = size - 1;
+			if (suffix == 0 || size == 0)
+				first = -1;
+		}
+		else
+		{
+			first = readnum(&s, end);
+			if (first < 0 || s >= end || *s != '-')
+				return -1;
+			s++;
+			last = readnum(&s, end);
+			if (last < 0)
+				last = size - 1;
+			else if (last < first)
+				return -1;
+			else if (last >= size)
+				last = size - 1;
+			if (first >= size)
+				first = -1;
+		}
+
+		skipspace(&s, end);
+		if (s < end && *s != ',')
+			return -1;
+
+		/* unsatisfiable specs are dropped, the rest are still served */
+		if (first >= 0)
+		{
+			ranges[n].first = first;
+			ranges[n].last = last;
+			n++;
+		}
+	}
+
+	if (specs == 0)
+		return -1;
+	return n;
+}
@@ -0,0 +1,10 @@
+#define RANGEMAX 16          /* most ranges honored in one request */
+
+/* inclusive byte range of the selected representation */
+struct byterange
+{
+    off_t first;
+    off_t last;
+};
+
+int parseranges(const char *value, unsigned int len, off_t size, struct byterange *ranges, int max);
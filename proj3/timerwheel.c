@@ -0,0 +1,132 @@
+// Ben Smith timerwheel.c hierarchical timing wheel for connection deadlines
+
+#include <stddef.h>
+#include "timerwheel.h"
+
+void wheelinit(struct wheel *w, unsigned long now)
+{
+	w->now = now;
+	w->pending = 0;
+	for (int l = 0; l < WHEELLEVELS; l++)
+	{
+		for (int i = 0; i < WHEELSIZE; i++)
+			w->slots[l][i].next = w->slots[l][i].prev = &w->slots[l][i];
+	}
+}
+
+void timerinit(struct timer *t, void *data)
+{
+	t->next = t->prev = NULL;
+	t->expires = 0;
+	t->data = data;
+}
+
+int timerpending(struct timer *t)
+{
+	return t->next != NULL;
+}
+
+static void link(struct wheel *w, struct timer *t)
+{
+	unsigned long delta = (t->expires > w->now) ? t->expires - w->now : 0;
+	struct timer *head;
+	int level = 0;
+
+	/* find the lowest level whose span reaches the deadline */
+	while (level < WHEELLEVELS - 1 && delta >= (1UL << (WHEELBITS * (level + 1))))
+		level++;
+	if (delta == 0)
+		t->expires = w->now + 1;
+	else if (level == WHEELLEVELS - 1 && delta >= (1UL << (WHEELBITS * WHEELLEVELS)))
+		t->expires = w->now + (1UL << (WHEELBITS * WHEELLEVELS)) - 1;
+	head = &w->slots[level][(t->expires >> (WHEELBITS * level)) & WHEELMASK];
+
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static void unlink(struct timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+}
+
+/* (re)arm t to fire at tick expires */
+void timerset(struct wheel *w, struct timer *t, unsigned long expires)
+{
+	if (timerpending(t))
+		unlink(t);
+	else
+		w->pending++;
+	t->expires = expires;
+	link(w, t);
+}
+
+void timerclear(struct wheel *w, struct timer *t)
+{
+	if (!timerpending(t))
+		return;
+	unlink(t);
+	w->pending--;
+}
+
+/* move every timer in a higher level slot down to where it now belongs */
+static void cascade(struct wheel *w, int level, int slot)
+{
+	struct timer *head = &w->slots[level][slot];
+
+	while (head->next != head)
+	{
+		struct timer *t = head->next;
+		unlink(t);
+		link(w, t);
+	}
+}
+
+/* run the wheel forward to tick now, calling fire for every timer that expires
+   fire may re-arm or clear any timer */
+void wheeladvance(struct wheel *w, unsigned long now, void (*fire)(struct timer *))
+{
+	struct timer expired;
+
+	/* nothing to expire, skip straight there */
+	if (w->pending == 0)
+	{
+		if (now > w->now)
+			w->now = now;
+		return;
+	}
+
+	while (w->now < now)
+	{
+		w->now++;
+		for (int l = 1; l < WHEELLEVELS; l++)
+		{
+			/* a level cascades each time every level below it wraps */
+			if ((w->now & ((1UL << (WHEELBITS * l)) - 1)) != 0)
+				break;
+			cascade(w, l, (w->now >> (WHEELBITS * l)) & WHEELMASK);
+		}
+
+		/* detach the slot first so callbacks can re-arm into it safely */
+		struct timer *head = &w->slots[0][w->now & WHEELMASK];
+		if (head->next == head)
+			continue;
+		expired.next = head->next;
+		expired.prev = head->prev;
+		expired.next->prev = &expired;
+		expired.prev->next = &expired;
+		head->next = head->prev = head;
+
+		while (expired.next != &expired)
+		{
+			struct timer *t = expired.next;
+			unlink(t);
+			w->pending--;
+			fire(t);
+		}
+	}
+}
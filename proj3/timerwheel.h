@@ -0,0 +1,30 @@
+#define WHEELBITS 6
+#define WHEELSIZE (1 << WHEELBITS)   /* slots per level */
+#define WHEELMASK (WHEELSIZE - 1)
+#define WHEELLEVELS 4                /* 64^4 ticks before timers saturate */
+
+/* intrusive timer, embed it in whatever it times out */
+struct timer
+{
+    struct timer *next;
+    struct timer *prev;
+    unsigned long expires;      /* in ticks */
+    void *data;
+};
+
+/* hierarchical timing wheel: level 0 holds the next 64 ticks one per slot,
+   each level above covers 64 times the span of the one below and is
+   cascaded down as time reaches it, so add, cancel and expiry are O(1) */
+struct wheel
+{
+    unsigned long now;
+    unsigned long pending;
+    struct timer slots[WHEELLEVELS][WHEELSIZE];  /* list heads */
+};
+
+void wheelinit(struct wheel *w, unsigned long now);
+void timerinit(struct timer *t, void *data);
+void timerset(struct wheel *w, struct timer *t, unsigned long expires);
+void timerclear(struct wheel *w, struct timer *t);
+int timerpending(struct timer *t);
+void wheeladvance(struct wheel *w, unsigned long now, void (*fire)(struct timer *));
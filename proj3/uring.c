@@ -0,0 +1,137 @@
+// Ben Smith uring.c io_uring setup, submission and completion without liburing
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "uring.h"
+
+/* sqes and the two rings are shared with the kernel, it owns sqhead and cqtail */
+int uringinit(struct uring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	size_t sqlen, cqlen;
+	unsigned int *array;
+
+	memset(r, 0x0, sizeof(struct uring));
+	memset(&p, 0x0, sizeof(p));
+	/* completions for every connection's outstanding request must fit */
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * 4;
+	if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return -1;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP))
+	{
+		close(r->fd);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->ringlen = (sqlen > cqlen) ? sqlen : cqlen;
+	r->ring = mmap(NULL, r->ringlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->ring == MAP_FAILED)
+	{
+		close(r->fd);
+		return -1;
+	}
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+				   IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+	{
+		munmap(r->ring, r->ringlen);
+		close(r->fd);
+		return -1;
+	}
+
+	r->entries = p.sq_entries;
+	r->sqhead = (unsigned int *)((char *)r->ring + p.sq_off.head);
+	r->sqtail = (unsigned int *)((char *)r->ring + p.sq_off.tail);
+	r->sqmask = *(unsigned int *)((char *)r->ring + p.sq_off.ring_mask);
+	r->cqhead = (unsigned int *)((char *)r->ring + p.cq_off.head);
+	r->cqtail = (unsigned int *)((char *)r->ring + p.cq_off.tail);
+	r->cqmask = *(unsigned int *)((char *)r->ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->ring + p.cq_off.cqes);
+	/* sqes are always used in ring order, so the index array never changes */
+	array = (unsigned int *)((char *)r->ring + p.sq_off.array);
+	for (unsigned int i = 0; i < p.sq_entries; i++)
+		array[i] = i;
+	r->tail = *r->sqtail;
+	return 0;
+}
+
+/* a zeroed sqe, NULL when every slot is waiting for the kernel: submit and ask again */
+struct io_uring_sqe *uringsqe(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+
+	if (r->tail - __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE) >= r->entries)
+		return NULL;
+	sqe = &r->sqes[r->tail & r->sqmask];
+	r->tail++;
+	memset(sqe, 0x0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+/* hand queued sqes to the kernel and wait up to waitns for a completion,
+   0 means do not wait and a negative waitns waits for as long as it takes */
+int uringsubmit(struct uring *r, long long waitns)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int submit;
+	int ret;
+
+	__atomic_store_n(r->sqtail, r->tail, __ATOMIC_RELEASE);
+	submit = r->tail - __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE);
+	if (waitns == 0)
+		ret = syscall(__NR_io_uring_enter, r->fd, submit, 0, 0, NULL, 0);
+	else
+	{
+		memset(&arg, 0x0, sizeof(arg));
+		if (waitns > 0)
+		{
+			ts.tv_sec = waitns / 1000000000LL;
+			ts.tv_nsec = waitns % 1000000000LL;
+			arg.ts = (unsigned long)&ts;
+		}
+		ret = syscall(__NR_io_uring_enter, r->fd, submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+	/* timing out or being interrupted just means there is nothing to reap */
+	if (ret < 0 && (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY))
+		return 0;
+	return ret;
+}
+
+/* oldest unseen completion, or NULL */
+struct io_uring_cqe *uringpeek(struct uring *r)
+{
+	unsigned int head = *r->cqhead;
+
+	if (head == __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &r->cqes[head & r->cqmask];
+}
+
+void uringseen(struct uring *r)
+{
+	__atomic_store_n(r->cqhead, *r->cqhead + 1, __ATOMIC_RELEASE);
+}
+
+/* pin buf as fixed buffer 0 for READ_FIXED and friends */
+int uringregister(struct uring *r, void *buf, size_t len)
+{
+	struct iovec iov = {buf, len};
+
+	return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, &iov, 1);
+}
+
+void uringfree(struct uring *r)
+{
+	munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+	munmap(r->ring, r->ringlen);
+	close(r->fd);
+}
@@ -0,0 +1,27 @@
+#include <linux/io_uring.h>
+
+/* one io_uring instance driven with raw syscalls, only the owning thread touches it */
+struct uring
+{
+    int fd;
+    unsigned int entries;
+    unsigned int tail;          /* next sqe to hand out, published on submit */
+    unsigned int *sqhead;
+    unsigned int *sqtail;
+    unsigned int sqmask;
+    unsigned int *cqhead;
+    unsigned int *cqtail;
+    unsigned int cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *ring;
+    size_t ringlen;
+};
+
+int uringinit(struct uring *r, unsigned int entries);
+struct io_uring_sqe *uringsqe(struct uring *r);
+int uringsubmit(struct uring *r, long long waitns);
+struct io_uring_cqe *uringpeek(struct uring *r);
+void uringseen(struct uring *r);
+int uringregister(struct uring *r, void *buf, size_t len);
+void uringfree(struct uring *r);
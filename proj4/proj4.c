@@ -15,6 +15,7 @@
 #include <netinet/tcp.h>  /* tcp header struct */
 #include <arpa/inet.h>
 #include "next.h"
+#include "ipv4.h"
 
 #define ARG_INFO 0x1
 #define ARG_SIZE 0x2
@@ -33,7 +34,7 @@ struct tcp_node *matrix_head = NULL;
 
 struct tcp_conn
 {
-	char *s_ip, *d_ip;
+	uint32_t s_addr, d_addr; /* host order, formatted only when printed */
 	int pkts;
 	unsigned long vol;
 };
@@ -41,7 +42,6 @@ struct tcp_conn
 struct tcp_node
 {
 	struct tcp_conn conn;
-	char *key; /* source ip appended with dest ip */
 	struct tcp_node *next;
 };
 
@@ -146,17 +146,14 @@ void print_tcp(int fd, struct pkt_info pkt)
 
 	while (next == 1)
 	{
-		struct in_addr source, dest;
-		char *s_ip, *d_ip;
+		char s_ip[IPV4BUFLEN], d_ip[IPV4BUFLEN];
 
 		if (pkt.iph != NULL && pkt.tcph != NULL && pkt.iph->protocol == 6)
 		{
 			printf("%f ", pkt.now);
-			source.s_addr = pkt.iph->saddr;
-			s_ip = inet_ntoa(source);
+			ipv4format(ntohl(pkt.iph->saddr), s_ip);
 			printf("%s %u ", s_ip, pkt.tcph->source);
-			dest.s_addr = pkt.iph->daddr;
-			d_ip = inet_ntoa(dest);
+			ipv4format(ntohl(pkt.iph->daddr), d_ip);
 			printf("%s %u ", d_ip, pkt.tcph->dest);
 			printf("%u %u %c %u %u\n", pkt.iph->ttl, pkt.iph->id, (pkt.tcph->syn) ? 'Y' : 'N', pkt.tcph->window, pkt.tcph->seq);
 		}
@@ -166,53 +163,27 @@ void print_tcp(int fd, struct pkt_info pkt)
 
 void make_matrix(struct tcp_conn conn)
 {
-	/* hash connection, search linked list
-	   if in linked list, update count and volume and free strings
-	   else add node using existing strings */
-	char *key = malloc(strlen(conn.s_ip) + strlen(conn.d_ip) + 1);
-	if (key == NULL)
-	{
-		errexit("error: cannot hash connection");
-	}
-
-	strcpy(key, conn.s_ip);
-	strcat(key, conn.d_ip);
+	/* search linked list for the address pair
+	   if in linked list, update count and volume
+	   else add node */
+	struct tcp_node *node = matrix_head;
+	while (node != NULL && (node->conn.s_addr != conn.s_addr || node->conn.d_addr != conn.d_addr))
+		node = node->next;
 
-	if (matrix_head == NULL)
+	if (node != NULL)
 	{
-		struct tcp_node *node = malloc(sizeof(struct tcp_node));
-		if (node == NULL)
-			errexit("error: could not allocate node");
-		node->conn = conn;
-		node->key = strdup(key);
-		node->next = NULL;
-		matrix_head = node;
+		node->conn.pkts++;
+		node->conn.vol += conn.vol;
 	}
 	else
 	{
-		struct tcp_node *node = matrix_head;
-		while (node != NULL && (strcmp(key, node->key) != 0))
-			node = node->next;
-
-		if (node != NULL)
-		{
-			node->conn.pkts++;
-			node->conn.vol += conn.vol;
-			free(conn.s_ip);
-			free(conn.d_ip);
-		}
-		else
-		{
-			struct tcp_node *new_node = malloc(sizeof(struct tcp_node));
-			if (new_node == NULL)
-				errexit("error: could not allocate node");
-			new_node->conn = conn;
-			new_node->key = strdup(key);
-			new_node->next = matrix_head;
-			matrix_head = new_node;
-		}
+		struct tcp_node *new_node = malloc(sizeof(struct tcp_node));
+		if (new_node == NULL)
+			errexit("error: could not allocate node");
+		new_node->conn = conn;
+		new_node->next = matrix_head;
+		matrix_head = new_node;
 	}
-	free(key);
 }
 
 void print_matrix(int fd, struct pkt_info pkt)
@@ -223,18 +194,9 @@ void print_matrix(int fd, struct pkt_info pkt)
 		if (pkt.iph != NULL && pkt.tcph != NULL && pkt.iph->protocol == 6)
 		{
 			struct tcp_conn this_conn;
-			struct in_addr source, dest;
-
-			source.s_addr = pkt.iph->saddr;
-			this_conn.s_ip = strdup(inet_ntoa(source));
-			if (this_conn.s_ip == NULL)
-				errexit("error: could not process ip");
-
-			dest.s_addr = pkt.iph->daddr;
-			this_conn.d_ip = strdup(inet_ntoa(dest));
-			if (this_conn.d_ip == NULL)
-				errexit("error: could not process ip");
 
+			this_conn.s_addr = ntohl(pkt.iph->saddr);
+			this_conn.d_addr = ntohl(pkt.iph->daddr);
 			this_conn.vol = pkt.iph->tot_len - ((uint8_t)pkt.iph->ihl * 4) - ((uint8_t)pkt.tcph->doff * 4);
 			this_conn.pkts = 1;
 
@@ -246,14 +208,14 @@ void print_matrix(int fd, struct pkt_info pkt)
 
 	struct tcp_node *node = matrix_head;
 	struct tcp_node *old;
+	char s_ip[IPV4BUFLEN], d_ip[IPV4BUFLEN];
 	while (node != NULL)
 	{
-		printf("%s %s %u %lu\n", node->conn.s_ip, node->conn.d_ip, node->conn.pkts, node->conn.vol);
+		ipv4format(node->conn.s_addr, s_ip);
+		ipv4format(node->conn.d_addr, d_ip);
+		printf("%s %s %u %lu\n", s_ip, d_ip, node->conn.pkts, node->conn.vol);
 		old = node;
 		node = node->next;
-		free(old->key);
-		free(old->conn.d_ip);
-		free(old->conn.s_ip);
 		free(old);
 	}
 }